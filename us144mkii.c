@@ -3,6 +3,9 @@
 
 #include "us144mkii.h"
 
+#define CREATE_TRACE_POINTS
+#include "us144mkii_trace.h"
+
 MODULE_AUTHOR("Šerif Rami <ramiserifpersia@gmail.com>");
 MODULE_DESCRIPTION("ALSA Driver for TASCAM US-144MKII");
 MODULE_LICENSE("GPL");
@@ -10,8 +13,25 @@ MODULE_LICENSE("GPL");
 static int index[SNDRV_CARDS] = SNDRV_DEFAULT_IDX;
 static char *id[SNDRV_CARDS] = SNDRV_DEFAULT_STR;
 static bool enable[SNDRV_CARDS] = { 1, [1 ...(SNDRV_CARDS - 1)] = 0 };
+static int latency_profile[SNDRV_CARDS] = { [0 ... (SNDRV_CARDS - 1)] = TASCAM_LATENCY_AUTO };
+static bool packet_schedule[SNDRV_CARDS] = { [0 ... (SNDRV_CARDS - 1)] = 1 };
+static bool zero_copy[SNDRV_CARDS];
+static int pll_bandwidth[SNDRV_CARDS] = { [0 ... (SNDRV_CARDS - 1)] = PLL_BANDWIDTH_DEFAULT };
 static atomic_t dev_idx = ATOMIC_INIT(0);
 
+module_param_array(latency_profile, int, NULL, 0444);
+MODULE_PARM_DESC(latency_profile,
+		 "Playback latency profile (-1=auto, 0=ultra-low, 1=low, 2=normal, 3=high, 4=bulk)");
+module_param_array(packet_schedule, bool, NULL, 0444);
+MODULE_PARM_DESC(packet_schedule,
+		 "Size playback packets from a precomputed per-rate schedule (default: on)");
+module_param_array(zero_copy, bool, NULL, 0444);
+MODULE_PARM_DESC(zero_copy,
+		 "Send playback straight from a DMA-able ring buffer instead of copying (default: off)");
+module_param_array(pll_bandwidth, int, NULL, 0444);
+MODULE_PARM_DESC(pll_bandwidth,
+		 "Rate estimator loop gain shift (1=widest ... 10=narrowest, default 6)");
+
 /**
  * tascam_free_urbs - free all URBs
  * @tascam: the tascam_card instance
@@ -24,10 +44,10 @@ void tascam_free_urbs(struct tascam_card *tascam)
 	usb_kill_anchored_urbs(&tascam->capture_anchor);
 	usb_kill_anchored_urbs(&tascam->midi_anchor);
 
-	for (i = 0; i < NUM_PLAYBACK_URBS; i++) {
+	for (i = 0; i < MAX_PLAYBACK_URBS; i++) {
 		if (tascam->playback_urbs[i]) {
 			usb_free_coherent(tascam->dev, tascam->playback_urb_alloc_size,
-							  tascam->playback_urbs[i]->transfer_buffer, tascam->playback_urbs[i]->transfer_dma);
+							  tascam->playback_urb_buf[i], tascam->playback_urb_dma[i]);
 			usb_free_urb(tascam->playback_urbs[i]);
 		}
 	}
@@ -38,20 +58,28 @@ void tascam_free_urbs(struct tascam_card *tascam)
 			usb_free_urb(tascam->feedback_urbs[i]);
 		}
 	}
-	for (i = 0; i < NUM_CAPTURE_URBS; i++) {
+	for (i = 0; i < MAX_CAPTURE_URBS; i++) {
 		if (tascam->capture_urbs[i]) {
-			usb_free_coherent(tascam->dev, CAPTURE_PACKET_SIZE,
+			usb_free_coherent(tascam->dev, CAPTURE_URB_MAX_BYTES,
 							  tascam->capture_urbs[i]->transfer_buffer, tascam->capture_urbs[i]->transfer_dma);
 			usb_free_urb(tascam->capture_urbs[i]);
 		}
 	}
-	if (tascam->midi_out_urb) {
-		usb_free_coherent(tascam->dev, MIDI_PACKET_SIZE, tascam->midi_out_buf, tascam->midi_out_urb->transfer_dma);
-		usb_free_urb(tascam->midi_out_urb);
+	for (i = 0; i < MIDI_OUT_URBS; i++) {
+		if (tascam->midi_out_urbs[i]) {
+			usb_free_coherent(tascam->dev, MIDI_OUT_URB_SIZE,
+					  tascam->midi_out_urbs[i]->transfer_buffer,
+					  tascam->midi_out_urbs[i]->transfer_dma);
+			usb_free_urb(tascam->midi_out_urbs[i]);
+		}
 	}
-	if (tascam->midi_in_urb) {
-		usb_free_coherent(tascam->dev, MIDI_PACKET_SIZE, tascam->midi_in_buf, tascam->midi_in_urb->transfer_dma);
-		usb_free_urb(tascam->midi_in_urb);
+	for (i = 0; i < MIDI_IN_URBS; i++) {
+		if (tascam->midi_in_urbs[i]) {
+			usb_free_coherent(tascam->dev, MIDI_PACKET_SIZE,
+					  tascam->midi_in_urbs[i]->transfer_buffer,
+					  tascam->midi_in_urbs[i]->transfer_dma);
+			usb_free_urb(tascam->midi_in_urbs[i]);
+		}
 	}
 }
 
@@ -64,10 +92,10 @@ void tascam_free_urbs(struct tascam_card *tascam)
 int tascam_alloc_urbs(struct tascam_card *tascam)
 {
 	int i;
-	tascam->playback_urb_alloc_size = PLAYBACK_URB_PACKETS * 156;
+	tascam->playback_urb_alloc_size = MAX_PLAYBACK_URB_PACKETS * PLAYBACK_PACKET_MAX_BYTES;
 
-	for (i = 0; i < NUM_PLAYBACK_URBS; i++) {
-		struct urb *urb = usb_alloc_urb(PLAYBACK_URB_PACKETS, GFP_KERNEL);
+	for (i = 0; i < MAX_PLAYBACK_URBS; i++) {
+		struct urb *urb = usb_alloc_urb(MAX_PLAYBACK_URB_PACKETS, GFP_KERNEL);
 		if (!urb)
 			return -ENOMEM;
 		tascam->playback_urbs[i] = urb;
@@ -75,6 +103,8 @@ int tascam_alloc_urbs(struct tascam_card *tascam)
 												  GFP_KERNEL, &urb->transfer_dma);
 		if (!urb->transfer_buffer)
 			return -ENOMEM;
+		tascam->playback_urb_buf[i] = urb->transfer_buffer;
+		tascam->playback_urb_dma[i] = urb->transfer_dma;
 		urb->dev = tascam->dev;
 		urb->pipe = usb_sndisocpipe(tascam->dev, EP_AUDIO_OUT);
 		urb->transfer_flags = URB_ISO_ASAP | URB_NO_TRANSFER_DMA_MAP;
@@ -83,9 +113,9 @@ int tascam_alloc_urbs(struct tascam_card *tascam)
 		urb->complete = playback_urb_complete;
 	}
 
-	tascam->feedback_urb_alloc_size = FEEDBACK_URB_PACKETS * FEEDBACK_PACKET_SIZE;
+	tascam->feedback_urb_alloc_size = GHOST_FEEDBACK_URB_PACKETS * FEEDBACK_PACKET_SIZE;
 	for (i = 0; i < NUM_FEEDBACK_URBS; i++) {
-		struct urb *urb = usb_alloc_urb(FEEDBACK_URB_PACKETS, GFP_KERNEL);
+		struct urb *urb = usb_alloc_urb(GHOST_FEEDBACK_URB_PACKETS, GFP_KERNEL);
 		if (!urb)
 			return -ENOMEM;
 		tascam->feedback_urbs[i] = urb;
@@ -101,17 +131,18 @@ int tascam_alloc_urbs(struct tascam_card *tascam)
 		urb->complete = feedback_urb_complete;
 	}
 
-	for (i = 0; i < NUM_CAPTURE_URBS; i++) {
+	for (i = 0; i < MAX_CAPTURE_URBS; i++) {
 		struct urb *urb = usb_alloc_urb(0, GFP_KERNEL);
 		void *buf;
 		if (!urb)
 			return -ENOMEM;
 		tascam->capture_urbs[i] = urb;
-		buf = usb_alloc_coherent(tascam->dev, CAPTURE_PACKET_SIZE, GFP_KERNEL, &urb->transfer_dma);
+		buf = usb_alloc_coherent(tascam->dev, CAPTURE_URB_MAX_BYTES, GFP_KERNEL, &urb->transfer_dma);
 		if (!buf)
 			return -ENOMEM;
 		usb_fill_bulk_urb(urb, tascam->dev, usb_rcvbulkpipe(tascam->dev, EP_AUDIO_IN),
-						  buf, CAPTURE_PACKET_SIZE, capture_urb_complete, tascam);
+						  buf, DEFAULT_CAPTURE_URB_FRAMES * CAPTURE_FRAME_SIZE,
+						  capture_urb_complete, tascam);
 		urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
 	}
 	return 0;
@@ -129,11 +160,79 @@ void tascam_stop_work_handler(struct work_struct *work)
 	usb_kill_anchored_urbs(&tascam->capture_anchor);
 }
 
+/**
+ * tascam_init_work_handler() - bring the device up
+ * @work: pointer to the work_struct
+ *
+ * Runs the vendor handshake and picks the capture decoder (first time
+ * only), selects the streaming altsettings and configures the sample rate:
+ * 48 kHz after probe, the rate in use before suspend after resume. On resume it also restarts what was
+ * running under the card's users' feet, the ghost stream for open MIDI
+ * or capture ports and the MIDI input URB, so nobody has to reopen.
+ * PCM streams themselves come back through their own resume trigger.
+ */
+static void tascam_init_work_handler(struct work_struct *work)
+{
+	struct tascam_card *tascam = container_of(work, struct tascam_card, init_work);
+	struct usb_device *dev = tascam->dev;
+	int rate = tascam->current_rate > 0 ? tascam->current_rate : 48000;
+	unsigned long flags;
+	bool restart = tascam->initialized;
+
+	if (!tascam->initialized) {
+		usb_control_msg(dev, usb_rcvctrlpipe(dev, 0), VENDOR_REQ_MODE_CONTROL,
+				RT_D2H_VENDOR_DEV, MODE_VAL_HANDSHAKE_READ, 0x0000,
+				tascam->scratch_buf, 1, USB_CTRL_TIMEOUT_MS);
+		tascam_select_capture_decoder(tascam);
+		tascam->initialized = true;
+	}
+
+	usb_set_interface(dev, 0, 1);
+	usb_set_interface(dev, 1, 1);
+
+	if (us144mkii_configure_device_for_rate(tascam, rate) < 0) {
+		dev_warn(&dev->dev, "Failed to initialize device at %d Hz\n", rate);
+		rate = 0;
+	}
+
+	spin_lock_irqsave(&tascam->playback_lock, flags);
+	tascam->current_rate = rate;
+	/* Suspend killed the URBs under a running ghost stream */
+	tascam->running_ghost_playback = false;
+	spin_unlock_irqrestore(&tascam->playback_lock, flags);
+
+	if (restart && rate > 0) {
+		if (atomic_read(&tascam->stream_refs) > 0)
+			tascam_playback_start_ghost(tascam);
+		if (tascam->midi_in_open)
+			tascam_midi_in_start(tascam);
+	}
+	if (restart)
+		tascam_midi_out_resume(tascam);
+
+	complete_all(&tascam->init_done);
+}
+
+/**
+ * tascam_wait_init() - wait for the device bring-up to finish
+ * @tascam: the tascam_card instance
+ *
+ * The card is registered before the device is configured; the first
+ * operation that needs the hardware blocks here instead.
+ *
+ * Return: 0 once the device is up, or -ERESTARTSYS if interrupted.
+ */
+int tascam_wait_init(struct tascam_card *tascam)
+{
+	return wait_for_completion_interruptible(&tascam->init_done);
+}
+
 static void tascam_card_private_free(struct snd_card *card)
 {
 	struct tascam_card *tascam = card->private_data;
 	if (tascam) {
 		tascam_free_urbs(tascam);
+		tascam_debugfs_exit(tascam);
 		if (tascam->dev)
 			usb_put_dev(tascam->dev);
 	}
@@ -146,11 +245,13 @@ static int tascam_suspend(struct usb_interface *intf, pm_message_t message)
 		return 0;
 
 	snd_pcm_suspend_all(tascam->pcm);
+	cancel_work_sync(&tascam->init_work);
 	cancel_work_sync(&tascam->stop_work);
 	cancel_work_sync(&tascam->stop_pcm_work);
 	usb_kill_anchored_urbs(&tascam->playback_anchor);
 	usb_kill_anchored_urbs(&tascam->feedback_anchor);
 	usb_kill_anchored_urbs(&tascam->capture_anchor);
+	tascam_midi_out_halt(tascam);
 	usb_kill_anchored_urbs(&tascam->midi_anchor);
 	return 0;
 }
@@ -161,10 +262,10 @@ static int tascam_resume(struct usb_interface *intf)
 	if (!tascam)
 		return 0;
 
-	usb_set_interface(tascam->dev, 0, 1);
-	usb_set_interface(tascam->dev, 1, 1);
-	if (tascam->current_rate > 0)
-		us144mkii_configure_device_for_rate(tascam, tascam->current_rate);
+	/* The device may have lost its configuration while suspended */
+	tascam->rate_regs_cached = false;
+	reinit_completion(&tascam->init_done);
+	schedule_work(&tascam->init_work);
 	return 0;
 }
 
@@ -172,8 +273,9 @@ static int tascam_probe(struct usb_interface *intf, const struct usb_device_id *
 {
 	struct usb_device *dev = interface_to_usbdev(intf);
 	struct snd_card *card;
+	struct snd_pcm_substream *loopback, *substream;
 	struct tascam_card *tascam;
-	int err, idx;
+	int err, idx, i;
 	const char *model_name;
 	char pcm_name[32];
 
@@ -200,11 +302,32 @@ static int tascam_probe(struct usb_interface *intf, const struct usb_device_id *
 	tascam->iface0 = intf;
 	tascam->dev_id = le16_to_cpu(dev->descriptor.idProduct);
 
-	spin_lock_init(&tascam->lock);
+	tascam->latency_profile = latency_profile[idx];
+	if (tascam->latency_profile < TASCAM_LATENCY_AUTO ||
+	    tascam->latency_profile >= TASCAM_LATENCY_PROFILE_COUNT)
+		tascam->latency_profile = TASCAM_LATENCY_AUTO;
+	tascam->playback_profile = (tascam->latency_profile == TASCAM_LATENCY_AUTO) ?
+				   TASCAM_LATENCY_NORMAL : tascam->latency_profile;
+	tascam->packet_schedule = packet_schedule[idx];
+	tascam->zero_copy = zero_copy[idx];
+	tascam->num_capture_urbs = DEFAULT_CAPTURE_URBS;
+	tascam->capture_urb_frames = DEFAULT_CAPTURE_URB_FRAMES;
+	tascam->pll.shift = clamp(pll_bandwidth[idx], PLL_BANDWIDTH_MIN, PLL_BANDWIDTH_MAX);
+
+	spin_lock_init(&tascam->playback_lock);
+	spin_lock_init(&tascam->capture_lock);
+	spin_lock_init(&tascam->loopback_lock);
+	spin_lock_init(&tascam->mix_lock);
+	seqcount_spinlock_init(&tascam->playback_seq, &tascam->playback_lock);
+	seqcount_spinlock_init(&tascam->capture_seq, &tascam->capture_lock);
+	init_waitqueue_head(&tascam->playback_ring_wait);
+	init_waitqueue_head(&tascam->mix_wait);
 	init_usb_anchor(&tascam->playback_anchor);
 	init_usb_anchor(&tascam->feedback_anchor);
 	init_usb_anchor(&tascam->capture_anchor);
 	init_usb_anchor(&tascam->midi_anchor);
+	INIT_WORK(&tascam->init_work, tascam_init_work_handler);
+	init_completion(&tascam->init_done);
 	INIT_WORK(&tascam->stop_work, tascam_stop_work_handler);
 	INIT_WORK(&tascam->stop_pcm_work, tascam_stop_pcm_work_handler);
 	atomic_set(&tascam->stream_refs, 0);
@@ -220,21 +343,53 @@ static int tascam_probe(struct usb_interface *intf, const struct usb_device_id *
 		  dev_name(&dev->dev));
 
 	snprintf(pcm_name, sizeof(pcm_name), "%s PCM", model_name);
-	err = snd_pcm_new(card, pcm_name, 0, 1, 1, &tascam->pcm);
+	err = snd_pcm_new(card, pcm_name, 0, TASCAM_PLAYBACK_SUBDEVICES,
+			  TASCAM_LOOPBACK_SUBDEVICE + 1, &tascam->pcm);
 	if (err < 0)
 		goto free_card;
 
 	tascam->pcm->private_data = tascam;
 	strscpy(tascam->pcm->name, pcm_name, sizeof(tascam->pcm->name));
 	snd_pcm_set_ops(tascam->pcm, SNDRV_PCM_STREAM_PLAYBACK, &tascam_playback_ops);
+	for (substream = tascam->pcm->streams[SNDRV_PCM_STREAM_PLAYBACK].substream->next;
+	     substream; substream = substream->next)
+		substream->ops = &tascam_mix_ops;
 	snd_pcm_set_ops(tascam->pcm, SNDRV_PCM_STREAM_CAPTURE, &tascam_capture_ops);
-
-	snd_pcm_set_managed_buffer_all(tascam->pcm, SNDRV_DMA_TYPE_VMALLOC, NULL, 0, 0);
+	loopback = tascam->pcm->streams[SNDRV_PCM_STREAM_CAPTURE].substream->next;
+	loopback->ops = &tascam_loopback_ops;
+	strscpy(loopback->name, "Loopback", sizeof(loopback->name));
+
+	if (tascam->zero_copy) {
+		/* The iso URBs point into the ring, so it has to be DMA-able */
+		snd_pcm_set_managed_buffer(tascam->pcm->streams[SNDRV_PCM_STREAM_PLAYBACK].substream,
+					   SNDRV_DMA_TYPE_DEV, dev->bus->sysdev, 0,
+					   tascam_playback_hw.buffer_bytes_max);
+		snd_pcm_set_managed_buffer(tascam->pcm->streams[SNDRV_PCM_STREAM_CAPTURE].substream,
+					   SNDRV_DMA_TYPE_VMALLOC, NULL, 0, 0);
+		snd_pcm_set_managed_buffer(loopback, SNDRV_DMA_TYPE_VMALLOC, NULL, 0, 0);
+		for (substream = tascam->pcm->streams[SNDRV_PCM_STREAM_PLAYBACK].substream->next;
+		     substream; substream = substream->next)
+			snd_pcm_set_managed_buffer(substream, SNDRV_DMA_TYPE_VMALLOC, NULL, 0, 0);
+	} else {
+		snd_pcm_set_managed_buffer_all(tascam->pcm, SNDRV_DMA_TYPE_VMALLOC, NULL, 0, 0);
+	}
 
 	err = tascam_create_midi(tascam);
 	if (err < 0)
 		goto free_card;
 
+	err = tascam_create_controls(tascam);
+	if (err < 0)
+		goto free_card;
+
+	err = tascam_playback_proc_init(tascam);
+	if (err < 0)
+		goto free_card;
+
+	err = tascam_debugfs_init(tascam);
+	if (err < 0)
+		goto free_card;
+
 	err = tascam_alloc_urbs(tascam);
 	if (err < 0)
 		goto free_card;
@@ -245,23 +400,22 @@ static int tascam_probe(struct usb_interface *intf, const struct usb_device_id *
 		goto free_card;
 	}
 
-	usb_control_msg(dev, usb_rcvctrlpipe(dev, 0), VENDOR_REQ_MODE_CONTROL,
-					RT_D2H_VENDOR_DEV, MODE_VAL_HANDSHAKE_READ, 0x0000,
-				 tascam->scratch_buf, 1, USB_CTRL_TIMEOUT_MS);
-
-	usb_set_interface(dev, 0, 1);
-	usb_set_interface(dev, 1, 1);
-
-	if (us144mkii_configure_device_for_rate(tascam, 48000) < 0)
-		dev_warn(&dev->dev, "Failed to initialize device at 48khz\n");
-	else
-		tascam->current_rate = 48000;
+	tascam->monitor.buf = devm_kcalloc(&dev->dev, MONITOR_RING_FRAMES * NUM_CHANNELS,
+					   sizeof(s32), GFP_KERNEL);
+	if (!tascam->monitor.buf) {
+		err = -ENOMEM;
+		goto free_card;
+	}
+	for (i = 0; i < NUM_CHANNELS; i++)
+		tascam->monitor.gain[i] = MONITOR_GAIN_UNITY;
 
 	err = snd_card_register(card);
 	if (err < 0)
 		goto free_card;
 
 	usb_set_intfdata(intf, tascam);
+	/* Configure the device in the background; hw_params waits for it */
+	schedule_work(&tascam->init_work);
 	return 0;
 
 	free_card:
@@ -280,13 +434,18 @@ static void tascam_disconnect(struct usb_interface *intf)
 	if (intf->cur_altsetting->desc.bInterfaceNumber == 0) {
 		atomic_set(&tascam->playback_active, 0);
 		atomic_set(&tascam->capture_active, 0);
+		atomic_set(&tascam->loopback_active, 0);
 
 		usb_kill_anchored_urbs(&tascam->playback_anchor);
 		usb_kill_anchored_urbs(&tascam->feedback_anchor);
 		usb_kill_anchored_urbs(&tascam->capture_anchor);
+		tascam_midi_out_halt(tascam);
 		usb_kill_anchored_urbs(&tascam->midi_anchor);
 
 		snd_card_disconnect(tascam->card);
+		cancel_work_sync(&tascam->init_work);
+		/* Let anyone still waiting for the bring-up find the card gone */
+		complete_all(&tascam->init_done);
 		cancel_work_sync(&tascam->stop_work);
 		cancel_work_sync(&tascam->stop_pcm_work);
 
@@ -4,15 +4,21 @@
 #ifndef __US144MKII_H
 #define __US144MKII_H
 
+#include <linux/completion.h>
+#include <linux/seqlock.h>
 #include <linux/timer.h>
 #include <linux/usb.h>
+#include <linux/wait.h>
 #include <linux/workqueue.h>
 #include <linux/atomic.h>
+#include <linux/ktime.h>
 #include <sound/core.h>
 #include <sound/initval.h>
 #include <sound/pcm.h>
 #include <sound/rawmidi.h>
 
+#include "us144mkii_debugfs.h"
+
 #define DRIVER_NAME "us144mkii"
 
 #define USB_VID_TASCAM 0x0644
@@ -48,25 +54,143 @@ enum tascam_mode_value {
 
 #define REG_VAL_ENABLE 0x0101
 
-#define NUM_PLAYBACK_URBS 4
-#define PLAYBACK_URB_PACKETS 8
+#define MAX_PLAYBACK_URBS 8
+#define MAX_PLAYBACK_URB_PACKETS 32
 #define NUM_FEEDBACK_URBS 4
 #define FEEDBACK_URB_PACKETS 1
 #define FEEDBACK_PACKET_SIZE 3
-#define NUM_CAPTURE_URBS 8
-#define CAPTURE_PACKET_SIZE 4096
+/*
+ * With no playback client the ghost stream runs from a few long URBs of
+ * silence: 4 ms per playback and per feedback URB, i.e. 250 completions/s
+ * on each endpoint instead of 1000 playback completions (8 packets per URB
+ * on the normal profile) and 2000 feedback completions.
+ */
+#define GHOST_PLAYBACK_URBS 4
+#define GHOST_URB_PACKETS MAX_PLAYBACK_URB_PACKETS
+#define GHOST_FEEDBACK_URB_PACKETS 8
+#define MAX_CAPTURE_URBS 16
+#define MIN_CAPTURE_URBS 4
+#define CAPTURE_FRAME_SIZE 64
+/* Bulk transfers are whole 512-byte packets, i.e. multiples of 8 frames */
+#define CAPTURE_URB_FRAME_ALIGN 8
+#define CAPTURE_URB_MAX_FRAMES 256
+#define CAPTURE_URB_MAX_BYTES (CAPTURE_URB_MAX_FRAMES * CAPTURE_FRAME_SIZE)
+#define DEFAULT_CAPTURE_URBS 8
+#define DEFAULT_CAPTURE_URB_FRAMES 64
 
 #define MIDI_PACKET_SIZE 9
 #define MIDI_PAYLOAD_SIZE 8
+#define MIDI_IN_URBS 4
+#define MIDI_OUT_URBS 4
+#define MIDI_OUT_URB_PACKETS 4
+#define MIDI_OUT_URB_SIZE (MIDI_OUT_URB_PACKETS * MIDI_PACKET_SIZE)
+/* DIN MIDI runs at 31250 baud with 10 bits per byte */
+#define MIDI_WIRE_BYTE_NS 320000
+/* MIDI bytes the device may hold beyond what has left the DIN port */
+#define MIDI_OUT_AHEAD_BYTES (2 * MIDI_OUT_URB_PACKETS * MIDI_PAYLOAD_SIZE)
 
 #define PLAYBACK_FRAME_SIZE 12
 #define MAX_FRAMES_PER_PACKET 13
+#define PLAYBACK_PACKET_MAX_BYTES (MAX_FRAMES_PER_PACKET * PLAYBACK_FRAME_SIZE)
+
+/* Longest nominal packet pattern: 44.1 kHz repeats every 80 microframes */
+#define PLAYBACK_SCHEDULE_MAX_LEN 80
+
+/**
+ * enum tascam_latency_profile - playback URB queue geometry presets
+ * @TASCAM_LATENCY_AUTO: pick the deepest profile that fits in one period
+ * @TASCAM_LATENCY_ULTRA_LOW: 2 URBs of 1 packet
+ * @TASCAM_LATENCY_LOW: 2 URBs of 4 packets
+ * @TASCAM_LATENCY_NORMAL: 4 URBs of 8 packets
+ * @TASCAM_LATENCY_HIGH: 4 URBs of 16 packets
+ * @TASCAM_LATENCY_BULK: 8 URBs of 32 packets
+ * @TASCAM_LATENCY_PROFILE_COUNT: number of fixed profiles
+ */
+enum tascam_latency_profile {
+	TASCAM_LATENCY_AUTO = -1,
+	TASCAM_LATENCY_ULTRA_LOW,
+	TASCAM_LATENCY_LOW,
+	TASCAM_LATENCY_NORMAL,
+	TASCAM_LATENCY_HIGH,
+	TASCAM_LATENCY_BULK,
+	TASCAM_LATENCY_PROFILE_COUNT,
+};
+
+#define PLL_BANDWIDTH_MIN 1
+#define PLL_BANDWIDTH_MAX 10
+#define PLL_BANDWIDTH_DEFAULT 6
+#define PLL_ACQUIRE_SHIFT 1
+#define PLL_ACQUIRE_UPDATES 16
+
+/**
+ * struct tascam_pll - second-order estimator of the device sample rate
+ * @rate: estimated frames per microframe, in Q32.32 format
+ * @drift: estimated change of @rate per feedback update, in Q32.32 format
+ * @updates: valid feedback samples seen, saturating past the acquire phase
+ * @shift: loop gain; alpha is 2^-shift and beta is 2^-(2 * shift + 2)
+ */
+struct tascam_pll {
+	s64 rate;
+	s64 drift;
+	unsigned int updates;
+	unsigned int shift;
+};
 
-#define PLL_FILTER_OLD_WEIGHT 3
-#define PLL_FILTER_NEW_WEIGHT 1
-#define PLL_FILTER_DIVISOR (PLL_FILTER_OLD_WEIGHT + PLL_FILTER_NEW_WEIGHT)
+#define NUM_CHANNELS 4
+/* Capture subdevice that returns what is sent to the outputs */
+#define TASCAM_LOOPBACK_SUBDEVICE 1
+/* Playback subdevices; all but the first are mixed into its URBs */
+#define TASCAM_PLAYBACK_SUBDEVICES 4
+
+/**
+ * struct tascam_mix_stream - a playback subdevice mixed in software
+ * @substream: the open substream, or NULL
+ * @active: the stream is running and contributes to the mix
+ * @pos: position in the substream's ring buffer
+ * @frames_consumed: frames mixed into outgoing URBs since prepare
+ * @last_period_pos: last period position
+ */
+struct tascam_mix_stream {
+	struct snd_pcm_substream *substream;
+	bool active;
+	snd_pcm_uframes_t pos;
+	u64 frames_consumed;
+	u64 last_period_pos;
+};
+/* Capture-to-playback monitor ring, a power of two above any URB backlog */
+#define MONITOR_RING_FRAMES 1024
+#define MONITOR_GAIN_SHIFT 12
+#define MONITOR_GAIN_UNITY (1 << MONITOR_GAIN_SHIFT)
+
+/**
+ * struct tascam_monitor - direct monitoring handoff from capture to playback
+ * @buf: ring of decoded S32 frames, NUM_CHANNELS samples each
+ * @head: frames written by the capture completion, free running
+ * @tail: frames taken by the playback completion, free running
+ * @enabled: mix the inputs into the playback stream
+ * @gain: per-input gain, MONITOR_GAIN_UNITY for 0 dB
+ *
+ * Single producer, single consumer: only the capture completion advances
+ * @head and only the playback completion advances @tail, so neither side
+ * takes a lock.
+ */
+struct tascam_monitor {
+	s32 *buf;
+	unsigned int head;
+	unsigned int tail;
+	bool enabled;
+	int gain[NUM_CHANNELS];
+};
 
 #define USB_CTRL_TIMEOUT_MS 1000
+/* Longest a stopped zero-copy queue may take to let go of the ALSA ring */
+#define TASCAM_RING_RELEASE_TIMEOUT_MS 100
+
+/* High-speed link timing */
+#define TASCAM_UFRAME_NS 125000
+#define TASCAM_FRAME_NS 1000000
+/* Linked starts further apart than this are not reported as a duplex offset */
+#define TASCAM_DUPLEX_MAX_NS NSEC_PER_SEC
 
 /**
  * struct tascam_card - private data for the TASCAM US-144MKII driver
@@ -81,38 +205,107 @@ enum tascam_mode_value {
  * @capture_substream: pointer to the PCM capture substream
  * @playback_urbs: array of URBs for PCM playback
  * @playback_urb_alloc_size: allocated size of each playback URB
+ * @playback_urb_buf: the coherent buffer owned by each playback URB
+ * @playback_urb_dma: DMA address of each playback URB's own buffer
+ * @zero_copy: playback URBs point into the ALSA ring instead of copying it
+ * @playback_ring_wait: woken when a zero-copy URB stops referencing the ALSA ring
+ * @num_playback_urbs: number of playback URBs in use by the current stream
+ * @playback_urb_packets: number of packets per playback URB in use
+ * @latency_profile: latency profile requested via module parameter
+ * @playback_profile: latency profile selected at the last playback hw_params
+ * @playback_urb_profile: latency profile the playback URBs were last built for,
+ *  or TASCAM_LATENCY_AUTO for the idle ghost geometry
  * @feedback_urbs: array of URBs for feedback
  * @feedback_urb_alloc_size: allocated size of each feedback URB
  * @capture_urbs: array of URBs for PCM capture
+ * @num_capture_urbs: number of capture URBs in flight for the current stream
+ * @capture_urb_frames: frames read by each capture URB for the current stream
+ * @decode_capture_simd: vectorised capture decoder chosen at init, or NULL
  * @playback_anchor: anchor for playback URBs
  * @feedback_anchor: anchor for feedback URBs
  * @capture_anchor: anchor for capture URBs
  * @midi_input: pointer to the MIDI input substream
  * @midi_output: pointer to the MIDI output substream
- * @midi_in_urb: URB for MIDI input
- * @midi_out_urb: URB for MIDI output
- * @midi_in_buf: buffer for MIDI input
- * @midi_out_buf: buffer for MIDI output
+ * @midi_in_urbs: URBs kept queued for MIDI input
+ * @midi_out_urbs: pool of URBs for MIDI output, several device packets each
  * @midi_anchor: anchor for MIDI URBs
- * @midi_out_active: flag indicating if MIDI output is active
+ * @midi_out_idle: bitmask of the MIDI output URBs not in flight
+ * @midi_out_halted: MIDI output is stopped for suspend or disconnect
+ * @midi_out_wire_ns: time at which the DIN port will have sent all MIDI
+ *  bytes handed to the device so far
+ * @midi_out_timer: retries MIDI output once the wire has caught up
+ * @midi_in_open: the MIDI input port is open and its URBs should be running
  * @midi_lock: spinlock for MIDI operations
- * @lock: spinlock for PCM operations
+ * @playback_lock: spinlock for playback position, PLL, ghost stream and rate state
+ * @capture_lock: spinlock for capture position state
+ * @playback_seq: seqcount guarding the playback position for lockless readers
+ * @capture_seq: seqcount guarding the capture position for lockless readers
  * @playback_active: atomic flag indicating if PCM playback is active
  * @capture_active: atomic flag indicating if PCM capture is active
  * @stream_refs: reference count for implicit stream users (Capture/MIDI)
  * @active_urbs: atomic counter for active URBs
  * @current_rate: current sample rate
+ * @rate_regs_cached: the rate-independent vendor registers are known to be set
  * @playback_frames_consumed: number of frames consumed by the playback device
+ * @playback_step_base: playback_frames_consumed before the last URB fill
+ * @playback_step_frames: number of frames taken by the last URB fill
+ * @playback_step_time: CLOCK_MONOTONIC time of the last URB fill, in ns
+ * @playback_urb_pos: ring position of the first frame carried by each playback URB
+ * @playback_urb_frames: number of ring frames carried by each playback URB
+ * @playback_link_frames: ring frames whose playback URBs have completed
+ * @playback_link_time: CLOCK_MONOTONIC time of the last link update, in ns
+ * @playback_link_start_pos: ring position at the start of the last completed URB
+ * @playback_link_start_time: CLOCK_MONOTONIC time the last completed URB started
+ *	going out, in ns, or 0 if none has completed yet
  * @driver_playback_pos: playback position in the ring buffer
  * @last_pb_period_pos: last playback period position
  * @capture_frames_processed: number of frames processed from the capture device
  * @driver_capture_pos: capture position in the ring buffer
+ * @capture_fill_pos: end of the ring region reserved by the capture decoder
+ * @capture_pair: input pair delivered by 2-channel capture, 0 for 1-2, 1 for 3-4
+ * @capture_link_time: CLOCK_MONOTONIC time of the last capture completion, in ns
  * @last_cap_period_pos: last capture period position
+ * @duplex_offset: frames from capture start to playback start for the last
+ *	linked start, 0 if unknown
+ * @duplex_pending: a linked start is waiting for its first playback completion
+ * @duplex_capture_time: CLOCK_MONOTONIC time capture was submitted on the
+ *	pending linked start, in ns, or 0 if not yet
+ * @duplex_playback_time: CLOCK_MONOTONIC time the first playback packet of
+ *	the pending linked start went out, in ns, or 0 if not yet known
+ * @monitor: direct monitoring ring and mix settings
+ * @loopback_substream: the loopback capture substream, a tap of the playback URBs
+ * @loopback_lock: spinlock for the loopback position and ring
+ * @loopback_active: atomic flag indicating if loopback capture is running
+ * @loopback_pos: loopback position in the ring buffer
+ * @loopback_frames: number of frames delivered to the loopback stream
+ * @last_lb_period_pos: last loopback period position
+ * @mix_streams: state of playback subdevices 1 and up
+ * @mix_lock: spinlock for @mix_streams
+ * @mix_streams_active: number of running secondary playback subdevices
+ * @mix_elapsed_busy: mix passes still signalling periods outside @mix_lock
+ * @mix_wait: woken when @mix_elapsed_busy drops to zero
+ * @packet_schedule: use the precomputed packet schedule on the playback path
+ * @playback_schedule: nominal frames per packet for one cycle at the current rate
+ * @playback_schedule_len: length of the schedule cycle, 0 if not available
+ * @playback_schedule_idx: next entry of the schedule to use
+ * @playback_nominal_q16: nominal frames per packet in Q16.16 format
+ * @playback_residual: accumulated feedback correction, in Q16.16 frames
+ * @pb_sizing_count: number of playback URBs sized since prepare
+ * @pb_sizing_ns: total time spent sizing playback URBs, in ns
+ * @pb_sizing_max_ns: longest time spent sizing a single playback URB, in ns
  * @phase_accum: phase accumulator for the playback PLL
  * @freq_q16: current frequency for the playback PLL in Q16.16 format
- * @feedback_synced: flag indicating if feedback is synced
- * @feedback_urb_skip_count: number of feedback URBs to skip at startup
+ * @pll: rate estimator fed by the feedback endpoint
+ * @feedback_synced: flag indicating if the estimator has finished acquiring
  * @running_ghost_playback: flag indicating if implicit playback is running
+ * @ghost_idle: the ghost stream runs on the idle geometry, from pre-zeroed
+ *  URBs that are never rewritten
+ * @stats: per-CPU statistics exposed through debugfs
+ * @stats_last_ns: time of the last completion per endpoint, for the gap histogram
+ * @debugfs_dir: the card's debugfs directory
+ * @init_work: brings the device up after probe and resume
+ * @init_done: completed once @init_work has run
+ * @initialized: the handshake of the first bring-up has been done
  * @stop_work: work struct for stopping all streams
  * @stop_pcm_work: work struct for stopping PCM streams
  */
@@ -129,11 +322,23 @@ struct tascam_card {
 	struct snd_pcm_substream *playback_substream;
 	struct snd_pcm_substream *capture_substream;
 
-	struct urb *playback_urbs[NUM_PLAYBACK_URBS];
+	struct urb *playback_urbs[MAX_PLAYBACK_URBS];
 	size_t playback_urb_alloc_size;
+	void *playback_urb_buf[MAX_PLAYBACK_URBS];
+	dma_addr_t playback_urb_dma[MAX_PLAYBACK_URBS];
+	bool zero_copy;
+	wait_queue_head_t playback_ring_wait;
+	unsigned int num_playback_urbs;
+	unsigned int playback_urb_packets;
+	int latency_profile;
+	int playback_profile;
+	int playback_urb_profile;
 	struct urb *feedback_urbs[NUM_FEEDBACK_URBS];
 	size_t feedback_urb_alloc_size;
-	struct urb *capture_urbs[NUM_CAPTURE_URBS];
+	struct urb *capture_urbs[MAX_CAPTURE_URBS];
+	unsigned int num_capture_urbs;
+	unsigned int capture_urb_frames;
+	void (*decode_capture_simd)(const u8 *src, u32 *dst, int frames);
 
 	struct usb_anchor playback_anchor;
 	struct usb_anchor feedback_anchor;
@@ -141,35 +346,90 @@ struct tascam_card {
 
 	struct snd_rawmidi_substream *midi_input;
 	struct snd_rawmidi_substream *midi_output;
-	struct urb *midi_in_urb;
-	struct urb *midi_out_urb;
-	u8 *midi_in_buf;
-	u8 *midi_out_buf;
+	struct urb *midi_in_urbs[MIDI_IN_URBS];
+	struct urb *midi_out_urbs[MIDI_OUT_URBS];
 	struct usb_anchor midi_anchor;
-	bool midi_out_active;
+	unsigned long midi_out_idle;
+	bool midi_out_halted;
+	u64 midi_out_wire_ns;
+	struct timer_list midi_out_timer;
+	bool midi_in_open;
 	spinlock_t midi_lock;
 
-	spinlock_t lock;
+	spinlock_t playback_lock;
+	spinlock_t capture_lock;
+	seqcount_spinlock_t playback_seq;
+	seqcount_spinlock_t capture_seq;
 	atomic_t playback_active;
 	atomic_t capture_active;
 	atomic_t stream_refs;
 	atomic_t active_urbs;
 	int current_rate;
+	bool rate_regs_cached;
 
 	u64 playback_frames_consumed;
+	u64 playback_step_base;
+	unsigned int playback_step_frames;
+	u64 playback_step_time;
+	u64 playback_urb_pos[MAX_PLAYBACK_URBS];
+	unsigned int playback_urb_frames[MAX_PLAYBACK_URBS];
+	u64 playback_link_frames;
+	u64 playback_link_time;
+	u64 playback_link_start_pos;
+	u64 playback_link_start_time;
 	snd_pcm_uframes_t driver_playback_pos;
 	u64 last_pb_period_pos;
 
 	u64 capture_frames_processed;
 	snd_pcm_uframes_t driver_capture_pos;
+	snd_pcm_uframes_t capture_fill_pos;
+	unsigned int capture_pair;
+	u64 capture_link_time;
 	u64 last_cap_period_pos;
+	unsigned int duplex_offset;
+	bool duplex_pending;
+	u64 duplex_capture_time;
+	u64 duplex_playback_time;
+	struct tascam_monitor monitor;
 
+	struct snd_pcm_substream *loopback_substream;
+	spinlock_t loopback_lock;
+	atomic_t loopback_active;
+	snd_pcm_uframes_t loopback_pos;
+	u64 loopback_frames;
+	u64 last_lb_period_pos;
+
+	struct tascam_mix_stream mix_streams[TASCAM_PLAYBACK_SUBDEVICES - 1];
+	spinlock_t mix_lock;
+	atomic_t mix_streams_active;
+	atomic_t mix_elapsed_busy;
+	wait_queue_head_t mix_wait;
+
+	bool packet_schedule;
+	u8 playback_schedule[PLAYBACK_SCHEDULE_MAX_LEN];
+	unsigned int playback_schedule_len;
+	unsigned int playback_schedule_idx;
+	u32 playback_nominal_q16;
+	s32 playback_residual;
+	u64 pb_sizing_count;
+	u64 pb_sizing_ns;
+	u64 pb_sizing_max_ns;
 	u32 phase_accum;
 	u32 freq_q16;
+	struct tascam_pll pll;
 	bool feedback_synced;
-	unsigned int feedback_urb_skip_count;
 	bool running_ghost_playback;
+	bool ghost_idle;
+
+#ifdef CONFIG_DEBUG_FS
+	struct tascam_stats __percpu *stats;
+	atomic64_t stats_last_ns[TASCAM_STATS_EP_COUNT];
+	struct dentry *debugfs_dir;
+#endif
 
+	struct work_struct init_work;
+	struct completion init_done;
+	bool initialized;
 	struct work_struct stop_work;
 	struct work_struct stop_pcm_work;
 };
@@ -177,10 +437,15 @@ struct tascam_card {
 void tascam_free_urbs(struct tascam_card *tascam);
 int tascam_alloc_urbs(struct tascam_card *tascam);
 void tascam_stop_work_handler(struct work_struct *work);
+int tascam_wait_init(struct tascam_card *tascam);
 void us144mkii_maybe_start_stream(struct tascam_card *tascam);
 void us144mkii_maybe_stop_stream(struct tascam_card *tascam);
 
 #include "us144mkii_pcm.h"
 int tascam_create_midi(struct tascam_card *tascam);
+int tascam_midi_in_start(struct tascam_card *tascam);
+void tascam_midi_out_halt(struct tascam_card *tascam);
+void tascam_midi_out_resume(struct tascam_card *tascam);
+int tascam_create_controls(struct tascam_card *tascam);
 
 #endif /* __US144MKII_H */
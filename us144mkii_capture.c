@@ -2,18 +2,32 @@
 // Copyright (c) 2025 Šerif Rami <ramiserifpersia@gmail.com>
 
 #include <linux/unaligned.h>
+#include <kunit/visibility.h>
+#if IS_ENABLED(CONFIG_ARCH_HAS_KERNEL_FPU_SUPPORT)
+#include <linux/fpu.h>
+#include <asm/simd.h>
+#endif
+#ifdef CONFIG_X86
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+#endif
 #include "us144mkii_pcm.h"
+#include "us144mkii_capture_simd.h"
+#include "us144mkii_trace.h"
 
 const struct snd_pcm_hardware tascam_capture_hw = {
 	.info = (SNDRV_PCM_INFO_MMAP | SNDRV_PCM_INFO_INTERLEAVED |
 	SNDRV_PCM_INFO_BLOCK_TRANSFER | SNDRV_PCM_INFO_MMAP_VALID |
-	SNDRV_PCM_INFO_PAUSE | SNDRV_PCM_INFO_RESUME),
-	.formats = SNDRV_PCM_FMTBIT_S32_LE,
+	SNDRV_PCM_INFO_PAUSE | SNDRV_PCM_INFO_RESUME |
+	SNDRV_PCM_INFO_NO_PERIOD_WAKEUP | SNDRV_PCM_INFO_HAS_LINK_ATIME |
+	SNDRV_PCM_INFO_HAS_LINK_ESTIMATED_ATIME),
+	.formats = (SNDRV_PCM_FMTBIT_S32_LE | SNDRV_PCM_FMTBIT_S24_3LE |
+	SNDRV_PCM_FMTBIT_S16_LE),
 	.rates = (SNDRV_PCM_RATE_44100 | SNDRV_PCM_RATE_48000 |
 	SNDRV_PCM_RATE_88200 | SNDRV_PCM_RATE_96000),
 	.rate_min = 44100,
 	.rate_max = 96000,
-	.channels_min = 4,
+	.channels_min = 2,
 	.channels_max = 4,
 	.buffer_bytes_max = 1024 * 1024,
 	.period_bytes_min = 768,
@@ -22,10 +36,36 @@ const struct snd_pcm_hardware tascam_capture_hw = {
 	.periods_max = 1024,
 };
 
+/**
+ * tascam_capture_select_geometry() - size the capture bulk transfers
+ * @tascam: the tascam_card instance
+ * @params: the hardware parameters of the capture stream
+ *
+ * Each URB reads about half a period, in whole 512-byte bulk packets, so a
+ * period is never held back waiting for a large read to fill up and large
+ * periods don't cost more completions than they need. Enough URBs are
+ * queued to cover two periods, within MIN_CAPTURE_URBS..MAX_CAPTURE_URBS.
+ * The URBs themselves are resized at prepare, once none is in flight.
+ */
+void tascam_capture_select_geometry(struct tascam_card *tascam, struct snd_pcm_hw_params *params)
+{
+	unsigned int period = params_period_size(params);
+	unsigned int frames, count;
+
+	frames = rounddown(period / 2, CAPTURE_URB_FRAME_ALIGN);
+	frames = clamp_t(unsigned int, frames, CAPTURE_URB_FRAME_ALIGN, CAPTURE_URB_MAX_FRAMES);
+	count = clamp_t(unsigned int, DIV_ROUND_UP(2 * period, frames),
+			MIN_CAPTURE_URBS, MAX_CAPTURE_URBS);
+
+	tascam->capture_urb_frames = frames;
+	tascam->num_capture_urbs = count;
+}
+
 static int tascam_capture_open(struct snd_pcm_substream *substream)
 {
 	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
 	substream->runtime->hw = tascam_capture_hw;
+	tascam_pcm_constrain_rate(substream);
 	tascam->capture_substream = substream;
 	atomic_set(&tascam->capture_active, 0);
 	return 0;
@@ -43,65 +83,110 @@ static int tascam_capture_close(struct snd_pcm_substream *substream)
 static int tascam_capture_prepare(struct snd_pcm_substream *substream)
 {
 	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
+	unsigned long flags;
+	int err, i;
+
+	err = tascam_wait_init(tascam);
+	if (err < 0)
+		return err;
+
 	usb_kill_anchored_urbs(&tascam->capture_anchor);
+	for (i = 0; i < MAX_CAPTURE_URBS; i++)
+		tascam->capture_urbs[i]->transfer_buffer_length =
+			tascam->capture_urb_frames * CAPTURE_FRAME_SIZE;
+
+	spin_lock_irqsave(&tascam->capture_lock, flags);
+	write_seqcount_begin(&tascam->capture_seq);
 	tascam->driver_capture_pos = 0;
 	tascam->capture_frames_processed = 0;
+	tascam->capture_link_time = ktime_get_ns();
+	write_seqcount_end(&tascam->capture_seq);
+	tascam->capture_fill_pos = 0;
 	tascam->last_cap_period_pos = 0;
+	spin_unlock_irqrestore(&tascam->capture_lock, flags);
 	return 0;
 }
 
+/**
+ * tascam_capture_start() - start reading capture data
+ * @tascam: the tascam_card instance
+ *
+ * Return: 0 on success, or a negative error code on failure.
+ */
+int tascam_capture_start(struct tascam_card *tascam)
+{
+	unsigned long flags;
+	int i, err, ret = 0;
+
+	spin_lock_irqsave(&tascam->capture_lock, flags);
+	if (atomic_read(&tascam->capture_active)) {
+		spin_unlock_irqrestore(&tascam->capture_lock, flags);
+		return 0;
+	}
+	atomic_set(&tascam->capture_active, 1);
+	spin_unlock_irqrestore(&tascam->capture_lock, flags);
+
+	us144mkii_maybe_start_stream(tascam);
+	spin_lock_irqsave(&tascam->capture_lock, flags);
+	for (i = 0; i < tascam->num_capture_urbs; i++) {
+		usb_anchor_urb(tascam->capture_urbs[i], &tascam->capture_anchor);
+		err = usb_submit_urb(tascam->capture_urbs[i], GFP_ATOMIC);
+		if (err < 0) {
+			trace_tascam_urb_submit_failed(tascam->capture_urbs[i], err);
+			usb_unanchor_urb(tascam->capture_urbs[i]);
+			ret = -EIO;
+			break;
+		}
+		trace_tascam_urb_submit(tascam->capture_urbs[i],
+					tascam->capture_urbs[i]->transfer_buffer_length, 0);
+		atomic_inc(&tascam->active_urbs);
+	}
+	spin_unlock_irqrestore(&tascam->capture_lock, flags);
+
+	if (ret < 0)
+		us144mkii_maybe_stop_stream(tascam);
+	return ret;
+}
+
 static int tascam_capture_trigger(struct snd_pcm_substream *substream, int cmd)
 {
 	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
-	int i, ret = 0;
-	bool start = false, stop = false;
+	int i, ret;
+	bool stop = false;
 	unsigned long flags;
 
-	spin_lock_irqsave(&tascam->lock, flags);
+	ret = tascam_pcm_trigger_linked(substream, cmd);
+	if (ret)
+		return ret < 0 ? ret : 0;
+
 	switch (cmd) {
-		case SNDRV_PCM_TRIGGER_START:
 		case SNDRV_PCM_TRIGGER_RESUME:
-			if (!atomic_read(&tascam->capture_active)) {
-				atomic_set(&tascam->capture_active, 1);
-				start = true;
-			}
-			break;
+			/* Not reconfigured yet; the client falls back to prepare */
+			if (!completion_done(&tascam->init_done))
+				return -EAGAIN;
+			fallthrough;
+		case SNDRV_PCM_TRIGGER_START:
+		case SNDRV_PCM_TRIGGER_PAUSE_RELEASE:
+			return tascam_capture_start(tascam);
 		case SNDRV_PCM_TRIGGER_STOP:
 		case SNDRV_PCM_TRIGGER_SUSPEND:
 		case SNDRV_PCM_TRIGGER_PAUSE_PUSH:
+			spin_lock_irqsave(&tascam->capture_lock, flags);
 			atomic_set(&tascam->capture_active, 0);
+			spin_unlock_irqrestore(&tascam->capture_lock, flags);
 			stop = true;
 			break;
 		default:
 			ret = -EINVAL;
 	}
-	spin_unlock_irqrestore(&tascam->lock, flags);
-
-	if (start) {
-		us144mkii_maybe_start_stream(tascam);
-		spin_lock_irqsave(&tascam->lock, flags);
-		for (i = 0; i < NUM_CAPTURE_URBS; i++) {
-			usb_anchor_urb(tascam->capture_urbs[i], &tascam->capture_anchor);
-			if (usb_submit_urb(tascam->capture_urbs[i], GFP_ATOMIC) < 0) {
-				usb_unanchor_urb(tascam->capture_urbs[i]);
-				ret = -EIO;
-				break;
-			}
-			atomic_inc(&tascam->active_urbs);
-		}
-		spin_unlock_irqrestore(&tascam->lock, flags);
-
-		if (ret < 0)
-			us144mkii_maybe_stop_stream(tascam);
-	}
 
 	if (stop) {
-		spin_lock_irqsave(&tascam->lock, flags);
-		for (i = 0; i < NUM_CAPTURE_URBS; i++) {
+		spin_lock_irqsave(&tascam->capture_lock, flags);
+		for (i = 0; i < MAX_CAPTURE_URBS; i++) {
 			if (tascam->capture_urbs[i])
 				usb_unlink_urb(tascam->capture_urbs[i]);
 		}
-		spin_unlock_irqrestore(&tascam->lock, flags);
+		spin_unlock_irqrestore(&tascam->capture_lock, flags);
 
 		us144mkii_maybe_stop_stream(tascam);
 	}
@@ -109,7 +194,29 @@ static int tascam_capture_trigger(struct snd_pcm_substream *substream, int cmd)
 	return ret;
 }
 
-static void tascam_decode_capture_chunk(const u8 *src, u32 *dst, int frames)
+/*
+ * Store one sample, given MSB-aligned in a u32, in the ring's layout. With a
+ * constant @format this folds to a single store.
+ */
+static __always_inline u8 *tascam_store_sample(u8 *dst, u32 v, snd_pcm_format_t format)
+{
+	switch (format) {
+	case SNDRV_PCM_FORMAT_S24_3LE:
+		dst[0] = v >> 8;
+		dst[1] = v >> 16;
+		dst[2] = v >> 24;
+		return dst + 3;
+	case SNDRV_PCM_FORMAT_S16_LE:
+		put_unaligned_le16(v >> 16, dst);
+		return dst + 2;
+	default:
+		put_unaligned_le32(v, dst);
+		return dst + 4;
+	}
+}
+
+static __always_inline void __tascam_decode_capture_chunk(const u8 *src, u8 *dst, int frames,
+							  snd_pcm_format_t format)
 {
 	int i;
 	u8 h[4], m[4], l[4];
@@ -132,27 +239,406 @@ static void tascam_decode_capture_chunk(const u8 *src, u32 *dst, int frames)
 
 		UNPACK(sa, &h[0], &h[2]); UNPACK(sa + 8, &m[0], &m[2]); UNPACK(sa + 16, &l[0], &l[2]);
 		UNPACK(sb, &h[1], &h[3]); UNPACK(sb + 8, &m[1], &m[3]); UNPACK(sb + 16, &l[1], &l[3]);
+		#undef UNPACK
+
+		dst = tascam_store_sample(dst, (h[0] << 24) | (m[0] << 16) | (l[0] << 8), format);
+		dst = tascam_store_sample(dst, (h[1] << 24) | (m[1] << 16) | (l[1] << 8), format);
+		dst = tascam_store_sample(dst, (h[2] << 24) | (m[2] << 16) | (l[2] << 8), format);
+		dst = tascam_store_sample(dst, (h[3] << 24) | (m[3] << 16) | (l[3] << 8), format);
+	}
+}
 
-		put_unaligned_le32((h[0] << 24) | (m[0] << 16) | (l[0] << 8), dst++);
-		put_unaligned_le32((h[1] << 24) | (m[1] << 16) | (l[1] << 8), dst++);
-		put_unaligned_le32((h[2] << 24) | (m[2] << 16) | (l[2] << 8), dst++);
-		put_unaligned_le32((h[3] << 24) | (m[3] << 16) | (l[3] << 8), dst++);
+/*
+ * Gather bit @lane of each of the 8 bytes at @p into one byte, MSB first:
+ * the same result as one output byte of the butterfly transpose above, for
+ * a fraction of the work when only half the channels are wanted.
+ */
+#define TASCAM_GATHER_LANE(p, lane) \
+	((u32)((((get_unaligned_le64(p) >> (lane)) & 0x0101010101010101ULL) * \
+		0x8040201008040201ULL) >> 56))
+
+static __always_inline void __tascam_decode_capture_pair(const u8 *src, u8 *dst, int frames,
+							 unsigned int pair, snd_pcm_format_t format)
+{
+	const u8 *sa, *sb;
+	int i;
+
+	/* Lane 0 of each word holds channels 1/2, lane 1 holds channels 3/4 */
+	for (i = 0; i < frames; i++) {
+		sa = src + (i * 64);
+		sb = sa + 32;
+		dst = tascam_store_sample(dst, (TASCAM_GATHER_LANE(sa, pair) << 24) |
+					  (TASCAM_GATHER_LANE(sa + 8, pair) << 16) |
+					  (TASCAM_GATHER_LANE(sa + 16, pair) << 8), format);
+		dst = tascam_store_sample(dst, (TASCAM_GATHER_LANE(sb, pair) << 24) |
+					  (TASCAM_GATHER_LANE(sb + 8, pair) << 16) |
+					  (TASCAM_GATHER_LANE(sb + 16, pair) << 8), format);
+	}
+}
+
+/*
+ * Decode one channel pair of each frame for 2-channel capture. @pair is 0
+ * for inputs 1-2 and 1 for inputs 3-4.
+ */
+static void tascam_decode_capture_pair(const u8 *src, u8 *dst, int frames,
+				       unsigned int pair, snd_pcm_format_t format)
+{
+	switch (format) {
+	case SNDRV_PCM_FORMAT_S24_3LE:
+		__tascam_decode_capture_pair(src, dst, frames, pair, SNDRV_PCM_FORMAT_S24_3LE);
+		break;
+	case SNDRV_PCM_FORMAT_S16_LE:
+		__tascam_decode_capture_pair(src, dst, frames, pair, SNDRV_PCM_FORMAT_S16_LE);
+		break;
+	default:
+		__tascam_decode_capture_pair(src, dst, frames, pair, SNDRV_PCM_FORMAT_S32_LE);
+		break;
+	}
+}
+
+/*
+ * Scalar reference decoder, also the fallback wherever the FPU/SIMD unit
+ * cannot be used from the completion handler.
+ */
+VISIBLE_IF_KUNIT void tascam_decode_capture_chunk(const u8 *src, u32 *dst, int frames)
+{
+	__tascam_decode_capture_chunk(src, (u8 *)dst, frames, SNDRV_PCM_FORMAT_S32_LE);
+}
+EXPORT_SYMBOL_IF_KUNIT(tascam_decode_capture_chunk);
+
+static void tascam_decode_capture_chunk_s24_3le(const u8 *src, u8 *dst, int frames)
+{
+	__tascam_decode_capture_chunk(src, dst, frames, SNDRV_PCM_FORMAT_S24_3LE);
+}
+
+static void tascam_decode_capture_chunk_s16le(const u8 *src, u8 *dst, int frames)
+{
+	__tascam_decode_capture_chunk(src, dst, frames, SNDRV_PCM_FORMAT_S16_LE);
+}
+
+#if IS_ENABLED(CONFIG_ARCH_HAS_KERNEL_FPU_SUPPORT)
+typedef void (*tascam_capture_decoder_t)(const u8 *src, u32 *dst, int frames);
+
+/* Odd, so the vector decoders' single-frame tails are exercised too */
+#define TASCAM_DECODER_CHECK_FRAMES 15
+
+/**
+ * tascam_check_capture_decoder() - verify a vector decoder against the scalar one
+ * @tascam: the tascam_card instance
+ * @src: TASCAM_DECODER_CHECK_FRAMES frames of raw capture data
+ * @ref: @src as decoded by tascam_decode_capture_chunk()
+ * @dst: scratch output buffer of the same size as @ref
+ * @decode: the decoder to check
+ * @name: name of the decoder, for the log
+ *
+ * The full equivalence and speed checks live in the KUnit suite; this only
+ * guards against a decoder that is broken on the machine at hand.
+ *
+ * Return: true if @decode produced exactly the same output as the reference.
+ */
+static bool tascam_check_capture_decoder(struct tascam_card *tascam, const u8 *src,
+					 const u32 *ref, u32 *dst,
+					 tascam_capture_decoder_t decode, const char *name)
+{
+	size_t len = TASCAM_DECODER_CHECK_FRAMES * 4 * sizeof(u32);
+
+	memset(dst, 0, len);
+	kernel_fpu_begin();
+	decode(src, dst, TASCAM_DECODER_CHECK_FRAMES);
+	kernel_fpu_end();
+
+	if (memcmp(dst, ref, len)) {
+		dev_warn(&tascam->dev->dev, "%s capture decoder mismatch, not using it\n", name);
+		return false;
 	}
+	return true;
 }
+#endif
 
 /**
- * capture_urb_complete() - completion handler for capture URBs
+ * tascam_select_capture_decoder() - pick the fastest capture decoder
+ * @tascam: the tascam_card instance
+ *
+ * Called once from the init work, before the first capture stream can be
+ * prepared, so its check does not delay probe. Prefers AVX2, then the
+ * 128-bit SSE2/NEON decoder, and leaves the scalar decoder in place when
+ * kernel-mode FPU is not available on this machine. A vector decoder is
+ * only used after it has decoded a few frames of pseudo-random data
+ * bit-exactly like the scalar one.
+ */
+void tascam_select_capture_decoder(struct tascam_card *tascam)
+{
+#if IS_ENABLED(CONFIG_ARCH_HAS_KERNEL_FPU_SUPPORT)
+	tascam_capture_decoder_t candidates[2];
+	const char *names[2];
+	unsigned int n = 0, i;
+	u32 *ref, *dst, x = 0x2545f491;
+	u8 *src;
+#endif
+
+	tascam->decode_capture_simd = NULL;
+#if IS_ENABLED(CONFIG_ARCH_HAS_KERNEL_FPU_SUPPORT)
+	if (!kernel_fpu_available())
+		return;
+#ifdef CONFIG_X86
+	if (boot_cpu_has(X86_FEATURE_AVX2) &&
+	    cpu_has_xfeatures(XFEATURE_MASK_SSE | XFEATURE_MASK_YMM, NULL)) {
+		names[n] = "avx2";
+		candidates[n++] = tascam_decode_capture_chunk_avx2;
+	}
+#endif
+	names[n] = "simd";
+	candidates[n++] = tascam_decode_capture_chunk_simd;
+
+	src = kmalloc(TASCAM_DECODER_CHECK_FRAMES * 64, GFP_KERNEL);
+	ref = kmalloc_array(TASCAM_DECODER_CHECK_FRAMES * 4, sizeof(u32), GFP_KERNEL);
+	dst = kmalloc_array(TASCAM_DECODER_CHECK_FRAMES * 4, sizeof(u32), GFP_KERNEL);
+	if (!src || !ref || !dst)
+		goto out;
+
+	/* xorshift32: a fixed pattern, so results are comparable across runs */
+	for (i = 0; i < TASCAM_DECODER_CHECK_FRAMES * 64; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		src[i] = x;
+	}
+
+	tascam_decode_capture_chunk(src, ref, TASCAM_DECODER_CHECK_FRAMES);
+
+	for (i = 0; i < n; i++) {
+		if (tascam_check_capture_decoder(tascam, src, ref, dst, candidates[i], names[i])) {
+			tascam->decode_capture_simd = candidates[i];
+			break;
+		}
+	}
+
+out:
+	kfree(dst);
+	kfree(ref);
+	kfree(src);
+#endif
+}
+
+#if IS_ENABLED(CONFIG_ARCH_HAS_KERNEL_FPU_SUPPORT)
+/* Frames the vector decoders produce at a time for the compact formats */
+#define TASCAM_CAPTURE_PACK_FRAMES 16
+
+static __always_inline void __tascam_pack_capture(const u32 *src, u8 *dst, int samples,
+						  snd_pcm_format_t format)
+{
+	int i;
+
+	for (i = 0; i < samples; i++)
+		dst = tascam_store_sample(dst, src[i], format);
+}
+
+/*
+ * The vector decoders only emit S32; for the compact formats they decode
+ * small blocks into a buffer that stays in L1 and get packed from there, so
+ * the ring itself only sees the compact layout.
+ */
+static void tascam_decode_capture_packed(struct tascam_card *tascam, const u8 *src, u8 *dst,
+					 int frames, snd_pcm_format_t format)
+{
+	u32 tmp[TASCAM_CAPTURE_PACK_FRAMES * 4];
+	int n, width = format == SNDRV_PCM_FORMAT_S24_3LE ? 3 : 2;
+
+	while (frames > 0) {
+		n = min(frames, TASCAM_CAPTURE_PACK_FRAMES);
+		tascam->decode_capture_simd(src, tmp, n);
+		if (format == SNDRV_PCM_FORMAT_S24_3LE)
+			__tascam_pack_capture(tmp, dst, n * 4, SNDRV_PCM_FORMAT_S24_3LE);
+		else
+			__tascam_pack_capture(tmp, dst, n * 4, SNDRV_PCM_FORMAT_S16_LE);
+		src += n * CAPTURE_FRAME_SIZE;
+		dst += n * 4 * width;
+		frames -= n;
+	}
+}
+#endif
+
+static void tascam_decode_capture(struct tascam_card *tascam, const u8 *src, u8 *dst,
+				  int frames, struct snd_pcm_runtime *runtime)
+{
+	snd_pcm_format_t format = runtime->format;
+
+	if (runtime->channels == 2) {
+		tascam_decode_capture_pair(src, dst, frames, READ_ONCE(tascam->capture_pair), format);
+		return;
+	}
+
+#if IS_ENABLED(CONFIG_ARCH_HAS_KERNEL_FPU_SUPPORT)
+	if (tascam->decode_capture_simd && may_use_simd()) {
+		kernel_fpu_begin();
+		if (format == SNDRV_PCM_FORMAT_S32_LE)
+			tascam->decode_capture_simd(src, (u32 *)dst, frames);
+		else
+			tascam_decode_capture_packed(tascam, src, dst, frames, format);
+		kernel_fpu_end();
+		return;
+	}
+#endif
+	switch (format) {
+	case SNDRV_PCM_FORMAT_S24_3LE:
+		tascam_decode_capture_chunk_s24_3le(src, dst, frames);
+		break;
+	case SNDRV_PCM_FORMAT_S16_LE:
+		tascam_decode_capture_chunk_s16le(src, dst, frames);
+		break;
+	default:
+		tascam_decode_capture_chunk(src, (u32 *)dst, frames);
+		break;
+	}
+}
+
+/* Decode @frames into the PCM ring at @pos, wrapping at its end */
+static void tascam_capture_decode_ring(struct tascam_card *tascam, const u8 *src,
+				       snd_pcm_uframes_t pos, int frames,
+				       struct snd_pcm_runtime *runtime)
+{
+	int part = min_t(int, frames, runtime->buffer_size - pos);
+
+	tascam_decode_capture(tascam, src, runtime->dma_area + frames_to_bytes(runtime, pos),
+			      part, runtime);
+	if (frames > part)
+		tascam_decode_capture(tascam, src + part * CAPTURE_FRAME_SIZE, runtime->dma_area,
+				      frames - part, runtime);
+}
+
+static __always_inline void __tascam_capture_pack(const u32 *src, u8 *dst, int frames,
+						  unsigned int channels, unsigned int first,
+						  snd_pcm_format_t format)
+{
+	unsigned int ch;
+	int i;
+
+	for (i = 0; i < frames; i++, src += NUM_CHANNELS) {
+		for (ch = 0; ch < channels; ch++)
+			dst = tascam_store_sample(dst, src[first + ch], format);
+	}
+}
+
+/*
+ * Convert already decoded S32 frames of all four inputs to the capture
+ * format. 2-channel capture takes the pair selected by capture_pair.
+ */
+static void tascam_capture_pack(struct tascam_card *tascam, const u32 *src, u8 *dst,
+				int frames, struct snd_pcm_runtime *runtime)
+{
+	unsigned int channels = runtime->channels;
+	unsigned int first = channels == 2 ? 2 * READ_ONCE(tascam->capture_pair) : 0;
+
+	switch (runtime->format) {
+	case SNDRV_PCM_FORMAT_S24_3LE:
+		__tascam_capture_pack(src, dst, frames, channels, first, SNDRV_PCM_FORMAT_S24_3LE);
+		break;
+	case SNDRV_PCM_FORMAT_S16_LE:
+		__tascam_capture_pack(src, dst, frames, channels, first, SNDRV_PCM_FORMAT_S16_LE);
+		break;
+	default:
+		if (channels == NUM_CHANNELS)
+			memcpy(dst, src, frames * NUM_CHANNELS * sizeof(u32));
+		else
+			__tascam_capture_pack(src, dst, frames, channels, first, SNDRV_PCM_FORMAT_S32_LE);
+		break;
+	}
+}
+
+/**
+ * tascam_monitor_push() - hand decoded input frames to the playback path
+ * @tascam: the tascam_card instance
+ * @src: the raw capture data
+ * @frames: number of frames in @src
+ *
+ * Decodes into the monitor ring as S32 regardless of the capture format.
+ * Frames that do not fit are left out; the playback side bounds the lag
+ * long before the ring fills in normal operation.
+ *
+ * Return: the number of frames decoded, from the ring's old head on.
+ */
+static int tascam_monitor_push(struct tascam_card *tascam, const u8 *src, int frames)
+{
+	struct tascam_monitor *mon = &tascam->monitor;
+	unsigned int head = mon->head;
+	unsigned int idx, n;
+	int left;
+	u32 *dst;
+
+	frames = min_t(unsigned int, frames,
+		       MONITOR_RING_FRAMES - (head - smp_load_acquire(&mon->tail)));
+	for (left = frames; left > 0; left -= n) {
+		idx = head & (MONITOR_RING_FRAMES - 1);
+		n = min_t(unsigned int, left, MONITOR_RING_FRAMES - idx);
+		dst = (u32 *)&mon->buf[idx * NUM_CHANNELS];
+#if IS_ENABLED(CONFIG_ARCH_HAS_KERNEL_FPU_SUPPORT)
+		if (tascam->decode_capture_simd && may_use_simd()) {
+			kernel_fpu_begin();
+			tascam->decode_capture_simd(src, dst, n);
+			kernel_fpu_end();
+		} else
+#endif
+			tascam_decode_capture_chunk(src, dst, n);
+		src += n * CAPTURE_FRAME_SIZE;
+		head += n;
+	}
+	smp_store_release(&mon->head, head);
+	return frames;
+}
+
+/*
+ * Store @frames of raw capture data into the PCM ring at @pos. With
+ * monitoring on, the frames are decoded once into the monitor ring and
+ * converted from there, so each URB is only decoded a single time; frames
+ * the monitor ring has no room for are decoded straight into the PCM ring.
+ */
+static void tascam_capture_store(struct tascam_card *tascam, const u8 *src,
+				 snd_pcm_uframes_t pos, int frames,
+				 struct snd_pcm_runtime *runtime)
+{
+	struct tascam_monitor *mon = &tascam->monitor;
+	unsigned int head = mon->head, midx;
+	snd_pcm_uframes_t pidx;
+	int pushed = 0, done, n;
+
+	if (READ_ONCE(mon->enabled))
+		pushed = tascam_monitor_push(tascam, src, frames);
+
+	for (done = 0; done < pushed; done += n) {
+		midx = (head + done) & (MONITOR_RING_FRAMES - 1);
+		pidx = (pos + done) % runtime->buffer_size;
+		n = min3(pushed - done, (int)(MONITOR_RING_FRAMES - midx),
+			 (int)(runtime->buffer_size - pidx));
+		tascam_capture_pack(tascam, (const u32 *)&mon->buf[midx * NUM_CHANNELS],
+				    runtime->dma_area + frames_to_bytes(runtime, pidx), n, runtime);
+	}
+
+	if (frames > pushed)
+		tascam_capture_decode_ring(tascam, src + pushed * CAPTURE_FRAME_SIZE,
+					   (pos + pushed) % runtime->buffer_size,
+					   frames - pushed, runtime);
+}
+
+/**
+ * __capture_urb_complete() - completion handler for capture URBs
  * @urb: the completed URB
  *
  * Decodes audio data, updates ring buffer, and handles period elapsed.
+ * The capture lock is only held to reserve the destination region and to
+ * publish the new position; the decode itself runs unlocked, and readers
+ * of the position go through capture_seq without taking the lock at all.
  */
-void capture_urb_complete(struct urb *urb)
+static void __capture_urb_complete(struct urb *urb)
 {
 	struct tascam_card *tascam = urb->context;
 	struct snd_pcm_runtime *runtime;
-	int frames, part1;
+	snd_pcm_uframes_t pos;
+	int frames;
 	unsigned long flags;
 	bool need_period_elapsed = false;
+	int err;
+
+	trace_tascam_urb_complete(urb, urb->actual_length, urb->actual_length / CAPTURE_FRAME_SIZE);
 
 	if (urb->status || !tascam || !tascam->dev)
 		goto exit;
@@ -161,43 +647,45 @@ void capture_urb_complete(struct urb *urb)
 		goto exit;
 
 	runtime = tascam->capture_substream->runtime;
-	frames = urb->actual_length / 64;
+	frames = urb->actual_length / CAPTURE_FRAME_SIZE;
 
 	if (frames > 0) {
-		spin_lock_irqsave(&tascam->lock, flags);
-
+		/* Reserve the ring region, then decode into it without the lock */
+		spin_lock_irqsave(&tascam->capture_lock, flags);
 		if (!atomic_read(&tascam->capture_active)) {
-			spin_unlock_irqrestore(&tascam->lock, flags);
+			spin_unlock_irqrestore(&tascam->capture_lock, flags);
 			goto exit;
 		}
+		pos = tascam->capture_fill_pos;
+		tascam->capture_fill_pos = (pos + frames) % runtime->buffer_size;
+		spin_unlock_irqrestore(&tascam->capture_lock, flags);
 
-		u32 *dma = (u32 *)(runtime->dma_area + frames_to_bytes(runtime, tascam->driver_capture_pos));
-
-		if (tascam->driver_capture_pos + frames <= runtime->buffer_size) {
-			tascam_decode_capture_chunk(urb->transfer_buffer, dma, frames);
-		} else {
-			part1 = runtime->buffer_size - tascam->driver_capture_pos;
-			tascam_decode_capture_chunk(urb->transfer_buffer, dma, part1);
-			tascam_decode_capture_chunk(urb->transfer_buffer + (part1 * 64),
-										(u32 *)runtime->dma_area, frames - part1);
-		}
+		tascam_capture_store(tascam, urb->transfer_buffer, pos, frames, runtime);
 
-		tascam->driver_capture_pos = (tascam->driver_capture_pos + frames) % runtime->buffer_size;
+		/* Publish the decoded frames */
+		spin_lock_irqsave(&tascam->capture_lock, flags);
+		write_seqcount_begin(&tascam->capture_seq);
+		tascam->driver_capture_pos = (pos + frames) % runtime->buffer_size;
 		tascam->capture_frames_processed += frames;
+		tascam->capture_link_time = ktime_get_ns();
+		write_seqcount_end(&tascam->capture_seq);
 
 		if (div_u64(tascam->capture_frames_processed, runtime->period_size) > tascam->last_cap_period_pos) {
 			tascam->last_cap_period_pos = div_u64(tascam->capture_frames_processed, runtime->period_size);
-			need_period_elapsed = true;
+			need_period_elapsed = !runtime->no_period_wakeup;
 		}
-		spin_unlock_irqrestore(&tascam->lock, flags);
+		spin_unlock_irqrestore(&tascam->capture_lock, flags);
 	}
 
 	usb_anchor_urb(urb, &tascam->capture_anchor);
-	if (usb_submit_urb(urb, GFP_ATOMIC) < 0) {
+	err = usb_submit_urb(urb, GFP_ATOMIC);
+	if (err < 0) {
+		trace_tascam_urb_submit_failed(urb, err);
 		usb_unanchor_urb(urb);
 		atomic_dec(&tascam->active_urbs);
 		return;
 	}
+	trace_tascam_urb_submit(urb, urb->transfer_buffer_length, 0);
 
 	if (need_period_elapsed)
 		snd_pcm_period_elapsed(tascam->capture_substream);
@@ -209,15 +697,102 @@ void capture_urb_complete(struct urb *urb)
 	atomic_dec(&tascam->active_urbs);
 }
 
+void capture_urb_complete(struct urb *urb)
+{
+	struct tascam_card *tascam = urb->context;
+	u64 start_ns = tascam_stats_begin();
+	int status = urb->status;
+
+	__capture_urb_complete(urb);
+	if (tascam)
+		tascam_stats_complete(tascam, TASCAM_STATS_CAPTURE, status, start_ns);
+}
+
+/**
+ * tascam_capture_get_time_info() - report link audio timestamps
+ * @substream: the ALSA PCM substream
+ * @system_ts: returns the system time the audio timestamp corresponds to
+ * @audio_ts: returns the audio timestamp
+ * @audio_tstamp_config: the timestamp type requested by userspace
+ * @audio_tstamp_report: returns the timestamp type and accuracy provided
+ *
+ * Capture runs over bulk transfers, so there is no iso start frame. LINK
+ * reports the frames received up to the last completed URB, paired with
+ * the completion time; as that is taken in the handler, it is answered as
+ * LINK_ESTIMATED with no accuracy given. LINK_ESTIMATED adds the frames
+ * the device has sampled since that completion at the nominal rate, capped
+ * at the size of one URB.
+ *
+ * Return: always 0.
+ */
+static int tascam_capture_get_time_info(struct snd_pcm_substream *substream,
+					struct timespec64 *system_ts, struct timespec64 *audio_ts,
+					struct snd_pcm_audio_tstamp_config *audio_tstamp_config,
+					struct snd_pcm_audio_tstamp_report *audio_tstamp_report)
+{
+	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	u64 frames, link_time, now;
+	unsigned int seq;
+
+	do {
+		seq = read_seqcount_begin(&tascam->capture_seq);
+		frames = tascam->capture_frames_processed;
+		link_time = tascam->capture_link_time;
+	} while (read_seqcount_retry(&tascam->capture_seq, seq));
+
+	switch (audio_tstamp_config->type_requested) {
+	case SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK:
+		now = ktime_get_ns();
+		snd_pcm_gettime(runtime, system_ts);
+		*system_ts = ns_to_timespec64(timespec64_to_ns(system_ts) - (now - link_time));
+		/* Paired with the completion time, not a controller timestamp */
+		audio_tstamp_report->actual_type = SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK_ESTIMATED;
+		audio_tstamp_report->accuracy_report = 0;
+		break;
+	case SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK_ESTIMATED:
+		now = ktime_get_ns();
+		snd_pcm_gettime(runtime, system_ts);
+		frames += min_t(u64, div_u64(min_t(u64, now - link_time, NSEC_PER_SEC) * runtime->rate,
+					     NSEC_PER_SEC),
+				tascam->capture_urb_frames);
+		audio_tstamp_report->actual_type = SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK_ESTIMATED;
+		audio_tstamp_report->accuracy = TASCAM_FRAME_NS;
+		audio_tstamp_report->accuracy_report = 1;
+		break;
+	default:
+		audio_tstamp_report->actual_type = SNDRV_PCM_AUDIO_TSTAMP_TYPE_DEFAULT;
+		return 0;
+	}
+
+	tascam_frames_to_timespec(frames, runtime->rate, audio_ts);
+	return 0;
+}
+
 static snd_pcm_uframes_t tascam_capture_pointer(struct snd_pcm_substream *substream)
 {
 	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
-	unsigned long flags;
+	struct snd_pcm_runtime *runtime = substream->runtime;
 	snd_pcm_uframes_t ptr;
+	u64 link_time, elapsed;
+	unsigned int seq;
+
+	do {
+		seq = read_seqcount_begin(&tascam->capture_seq);
+		ptr = tascam->driver_capture_pos;
+		link_time = tascam->capture_link_time;
+	} while (read_seqcount_retry(&tascam->capture_seq, seq));
 
-	spin_lock_irqsave(&tascam->lock, flags);
-	ptr = tascam->driver_capture_pos;
-	spin_unlock_irqrestore(&tascam->lock, flags);
+	/*
+	 * Frames sampled since the last completion are sitting in the pending
+	 * bulk URB; it hands them over at most one URB's worth at a time.
+	 */
+	runtime->delay = 0;
+	if (atomic_read(&tascam->capture_active)) {
+		elapsed = min_t(u64, ktime_get_ns() - link_time, NSEC_PER_SEC);
+		runtime->delay = min_t(u64, div_u64(elapsed * runtime->rate, NSEC_PER_SEC),
+				       tascam->capture_urb_frames);
+	}
 
 	return ptr;
 }
@@ -230,4 +805,5 @@ const struct snd_pcm_ops tascam_capture_ops = {
 	.prepare = tascam_capture_prepare,
 	.trigger = tascam_capture_trigger,
 	.pointer = tascam_capture_pointer,
+	.get_time_info = tascam_capture_get_time_info,
 };
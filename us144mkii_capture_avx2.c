@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (c) 2025 Šerif Rami <ramiserifpersia@gmail.com>
+
+#include <linux/string.h>
+#include <linux/unaligned.h>
+#include <kunit/visibility.h>
+#include "us144mkii_capture_simd.h"
+
+typedef u64 v4u64 __attribute__((vector_size(32)));
+typedef u32 v8u32 __attribute__((vector_size(32)));
+
+/* Gather one word from each half of two consecutive frames */
+static __always_inline v4u64 tascam_load4(const u8 *s)
+{
+	return (v4u64){ get_unaligned_le64(s), get_unaligned_le64(s + 32),
+			get_unaligned_le64(s + 64), get_unaligned_le64(s + 96) };
+}
+
+/**
+ * tascam_decode_capture_chunk_avx2() - 256-bit vector capture decoder
+ * @src: raw capture data, 64 bytes per frame
+ * @dst: destination in the ALSA ring buffer, 4 samples per frame
+ * @frames: number of frames to decode
+ *
+ * Decodes two frames per iteration; an odd trailing frame goes through the
+ * 128-bit decoder.
+ */
+void tascam_decode_capture_chunk_avx2(const u8 *src, u32 *dst, int frames)
+{
+	for (; frames >= 2; frames -= 2, src += 128, dst += 8) {
+		v4u64 h = TASCAM_FLIP_LANES(tascam_load4(src));
+		v4u64 m = TASCAM_FLIP_LANES(tascam_load4(src + 8));
+		v4u64 l = TASCAM_FLIP_LANES(tascam_load4(src + 16));
+		v8u32 o = (v8u32)(TASCAM_SAMPLE_LO(h, m, l) | (TASCAM_SAMPLE_HI(h, m, l) << 32));
+
+		o = TASCAM_SHUFFLE(o, v8u32, 0, 2, 1, 3, 4, 6, 5, 7);
+		memcpy(dst, &o, sizeof(o));
+	}
+	if (frames)
+		tascam_decode_capture_chunk_simd(src, dst, frames);
+}
+EXPORT_SYMBOL_IF_KUNIT(tascam_decode_capture_chunk_avx2);
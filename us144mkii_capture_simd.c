@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (c) 2025 Šerif Rami <ramiserifpersia@gmail.com>
+
+#include <linux/string.h>
+#include <linux/unaligned.h>
+#include <kunit/visibility.h>
+#include "us144mkii_capture_simd.h"
+
+typedef u64 v2u64 __attribute__((vector_size(16)));
+typedef u32 v4u32 __attribute__((vector_size(16)));
+
+/*
+ * One 64-byte device frame: lane 0 carries channels 1/3 (first half of the
+ * frame), lane 1 channels 2/4 (second half). This maps onto SSE2 on x86 and
+ * NEON on arm64.
+ */
+static __always_inline void tascam_decode_frame_simd(const u8 *sa, u32 *dst)
+{
+	v2u64 h = TASCAM_FLIP_LANES(((v2u64){ get_unaligned_le64(sa), get_unaligned_le64(sa + 32) }));
+	v2u64 m = TASCAM_FLIP_LANES(((v2u64){ get_unaligned_le64(sa + 8), get_unaligned_le64(sa + 40) }));
+	v2u64 l = TASCAM_FLIP_LANES(((v2u64){ get_unaligned_le64(sa + 16), get_unaligned_le64(sa + 48) }));
+	v4u32 o = (v4u32)(TASCAM_SAMPLE_LO(h, m, l) | (TASCAM_SAMPLE_HI(h, m, l) << 32));
+
+	o = TASCAM_SHUFFLE(o, v4u32, 0, 2, 1, 3);
+	memcpy(dst, &o, sizeof(o));
+}
+
+/**
+ * tascam_decode_capture_chunk_simd() - 128-bit vector capture decoder
+ * @src: raw capture data, 64 bytes per frame
+ * @dst: destination in the ALSA ring buffer, 4 samples per frame
+ * @frames: number of frames to decode
+ */
+void tascam_decode_capture_chunk_simd(const u8 *src, u32 *dst, int frames)
+{
+	for (; frames >= 2; frames -= 2, src += 128, dst += 8) {
+		tascam_decode_frame_simd(src, dst);
+		tascam_decode_frame_simd(src + 64, dst + 4);
+	}
+	if (frames)
+		tascam_decode_frame_simd(src, dst);
+}
+EXPORT_SYMBOL_IF_KUNIT(tascam_decode_capture_chunk_simd);
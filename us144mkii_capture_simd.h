@@ -0,0 +1,51 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+// Copyright (c) 2025 Šerif Rami <ramiserifpersia@gmail.com>
+
+#ifndef __US144MKII_CAPTURE_SIMD_H
+#define __US144MKII_CAPTURE_SIMD_H
+
+#include <linux/types.h>
+
+/*
+ * Vectorised capture decoders. These live in their own translation units
+ * built with CC_FLAGS_FPU and must only be called between kernel_fpu_begin()
+ * and kernel_fpu_end(); tascam_decode_capture_chunk() is the reference.
+ */
+void tascam_decode_capture_chunk_simd(const u8 *src, u32 *dst, int frames);
+void tascam_decode_capture_chunk_avx2(const u8 *src, u32 *dst, int frames);
+
+/*
+ * Anti-diagonal 8x8 bit-matrix flip of every 64-bit lane. Applied to the raw
+ * little-endian capture word it moves bit 0 of byte k to bit 7-k of byte 7
+ * and bit 1 of byte k to bit 7-k of byte 6, which is exactly what the
+ * bswap + transpose of the scalar decoder leaves in bytes 0 and 1. Skipping
+ * the byte swap keeps the whole decode in plain shift/and/xor lane ops.
+ */
+#define TASCAM_FLIP_LANES(v) ({ \
+	typeof(v) __x = (v), __t; \
+	__t = __x ^ (__x << 36); \
+	__x ^= 0xf0f0f0f00f0f0f0fULL & (__t ^ (__x >> 36)); \
+	__t = 0xcccc0000cccc0000ULL & (__x ^ (__x << 18)); \
+	__x ^= __t ^ (__t >> 18); \
+	__t = 0xaa00aa00aa00aa00ULL & (__x ^ (__x << 9)); \
+	__x ^= __t ^ (__t >> 9); \
+	__x; \
+})
+
+/*
+ * Permute the lanes of @v. __builtin_shufflevector() only reached GCC in
+ * version 12, so GCC gets __builtin_shuffle() with a mask of @mask_type.
+ */
+#ifdef __clang__
+#define TASCAM_SHUFFLE(v, mask_type, ...) __builtin_shufflevector(v, v, __VA_ARGS__)
+#else
+#define TASCAM_SHUFFLE(v, mask_type, ...) __builtin_shuffle(v, (mask_type){ __VA_ARGS__ })
+#endif
+
+/* Assemble the left-justified 24-bit samples carried in byte 7 / byte 6 */
+#define TASCAM_SAMPLE_LO(h, m, l) \
+	((((h) >> 32) & 0xff000000) | (((m) >> 40) & 0xff0000) | (((l) >> 48) & 0xff00))
+#define TASCAM_SAMPLE_HI(h, m, l) \
+	((((h) >> 24) & 0xff000000) | (((m) >> 32) & 0xff0000) | (((l) >> 40) & 0xff00))
+
+#endif /* __US144MKII_CAPTURE_SIMD_H */
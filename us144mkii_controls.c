@@ -0,0 +1,231 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (c) 2025 Šerif Rami <ramiserifpersia@gmail.com>
+
+#include <sound/control.h>
+#include <sound/tlv.h>
+#include "us144mkii.h"
+
+static int tascam_measured_rate_info(struct snd_kcontrol *kcontrol,
+				     struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = 1;
+	uinfo->value.integer.min = 0;
+	uinfo->value.integer.max = 200000000;
+	uinfo->value.integer.step = 1;
+	return 0;
+}
+
+static int tascam_measured_rate_get(struct snd_kcontrol *kcontrol,
+				    struct snd_ctl_elem_value *ucontrol)
+{
+	struct tascam_card *tascam = snd_kcontrol_chip(kcontrol);
+
+	ucontrol->value.integer.value[0] = tascam_measured_rate_mhz(tascam);
+	return 0;
+}
+
+/*
+ * Sample rate the device is actually consuming at, in mHz, as tracked from
+ * the feedback endpoint. Reads 0 while no stream is running.
+ */
+static const struct snd_kcontrol_new tascam_measured_rate_ctl = {
+	.iface = SNDRV_CTL_ELEM_IFACE_PCM,
+	.name = "Measured Sample Rate",
+	.access = SNDRV_CTL_ELEM_ACCESS_READ | SNDRV_CTL_ELEM_ACCESS_VOLATILE,
+	.info = tascam_measured_rate_info,
+	.get = tascam_measured_rate_get,
+};
+
+static int tascam_duplex_offset_info(struct snd_kcontrol *kcontrol,
+				     struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = 1;
+	uinfo->value.integer.min = 0;
+	uinfo->value.integer.max = tascam_playback_hw.rate_max;
+	uinfo->value.integer.step = 1;
+	return 0;
+}
+
+static int tascam_duplex_offset_get(struct snd_kcontrol *kcontrol,
+				    struct snd_ctl_elem_value *ucontrol)
+{
+	struct tascam_card *tascam = snd_kcontrol_chip(kcontrol);
+
+	ucontrol->value.integer.value[0] = READ_ONCE(tascam->duplex_offset);
+	return 0;
+}
+
+/*
+ * Frames by which playback started after capture on the last linked
+ * duplex start, as measured from the first playback completion, or 0 if
+ * unknown. Offsets of a second or more are not reported.
+ */
+static const struct snd_kcontrol_new tascam_duplex_offset_ctl = {
+	.iface = SNDRV_CTL_ELEM_IFACE_PCM,
+	.name = "Duplex Start Offset",
+	.access = SNDRV_CTL_ELEM_ACCESS_READ | SNDRV_CTL_ELEM_ACCESS_VOLATILE,
+	.info = tascam_duplex_offset_info,
+	.get = tascam_duplex_offset_get,
+};
+
+static int tascam_capture_pair_info(struct snd_kcontrol *kcontrol,
+				    struct snd_ctl_elem_info *uinfo)
+{
+	static const char *const texts[] = { "Inputs 1-2", "Inputs 3-4" };
+
+	return snd_ctl_enum_info(uinfo, 1, ARRAY_SIZE(texts), texts);
+}
+
+static int tascam_capture_pair_get(struct snd_kcontrol *kcontrol,
+				   struct snd_ctl_elem_value *ucontrol)
+{
+	struct tascam_card *tascam = snd_kcontrol_chip(kcontrol);
+
+	ucontrol->value.enumerated.item[0] = READ_ONCE(tascam->capture_pair);
+	return 0;
+}
+
+static int tascam_capture_pair_put(struct snd_kcontrol *kcontrol,
+				   struct snd_ctl_elem_value *ucontrol)
+{
+	struct tascam_card *tascam = snd_kcontrol_chip(kcontrol);
+	unsigned int pair = ucontrol->value.enumerated.item[0];
+
+	if (pair > 1)
+		return -EINVAL;
+	if (READ_ONCE(tascam->capture_pair) == pair)
+		return 0;
+	WRITE_ONCE(tascam->capture_pair, pair);
+	return 1;
+}
+
+/*
+ * Which two inputs a 2-channel capture stream delivers. 4-channel streams
+ * always get all inputs.
+ */
+static const struct snd_kcontrol_new tascam_capture_pair_ctl = {
+	.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+	.name = "Capture Channel Pair",
+	.info = tascam_capture_pair_info,
+	.get = tascam_capture_pair_get,
+	.put = tascam_capture_pair_put,
+};
+
+static int tascam_monitor_switch_get(struct snd_kcontrol *kcontrol,
+				     struct snd_ctl_elem_value *ucontrol)
+{
+	struct tascam_card *tascam = snd_kcontrol_chip(kcontrol);
+
+	ucontrol->value.integer.value[0] = READ_ONCE(tascam->monitor.enabled);
+	return 0;
+}
+
+static int tascam_monitor_switch_put(struct snd_kcontrol *kcontrol,
+				     struct snd_ctl_elem_value *ucontrol)
+{
+	struct tascam_card *tascam = snd_kcontrol_chip(kcontrol);
+	bool enabled = !!ucontrol->value.integer.value[0];
+
+	if (READ_ONCE(tascam->monitor.enabled) == enabled)
+		return 0;
+	WRITE_ONCE(tascam->monitor.enabled, enabled);
+	return 1;
+}
+
+/*
+ * Mix the inputs straight into the outputs from the URB completions, for
+ * monitoring without a round trip through userspace. Only runs while a
+ * capture stream is open, since that is what brings the input data in.
+ */
+static const struct snd_kcontrol_new tascam_monitor_switch_ctl = {
+	.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+	.name = "Monitor Playback Switch",
+	.info = snd_ctl_boolean_mono_info,
+	.get = tascam_monitor_switch_get,
+	.put = tascam_monitor_switch_put,
+};
+
+static int tascam_monitor_volume_info(struct snd_kcontrol *kcontrol,
+				      struct snd_ctl_elem_info *uinfo)
+{
+	uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+	uinfo->count = NUM_CHANNELS;
+	uinfo->value.integer.min = 0;
+	uinfo->value.integer.max = MONITOR_GAIN_UNITY;
+	uinfo->value.integer.step = 1;
+	return 0;
+}
+
+static int tascam_monitor_volume_get(struct snd_kcontrol *kcontrol,
+				     struct snd_ctl_elem_value *ucontrol)
+{
+	struct tascam_card *tascam = snd_kcontrol_chip(kcontrol);
+	int i;
+
+	for (i = 0; i < NUM_CHANNELS; i++)
+		ucontrol->value.integer.value[i] = READ_ONCE(tascam->monitor.gain[i]);
+	return 0;
+}
+
+static int tascam_monitor_volume_put(struct snd_kcontrol *kcontrol,
+				     struct snd_ctl_elem_value *ucontrol)
+{
+	struct tascam_card *tascam = snd_kcontrol_chip(kcontrol);
+	int i, changed = 0;
+	long gain;
+
+	for (i = 0; i < NUM_CHANNELS; i++) {
+		gain = ucontrol->value.integer.value[i];
+		if (gain < 0 || gain > MONITOR_GAIN_UNITY)
+			return -EINVAL;
+		if (READ_ONCE(tascam->monitor.gain[i]) != gain) {
+			WRITE_ONCE(tascam->monitor.gain[i], gain);
+			changed = 1;
+		}
+	}
+	return changed;
+}
+
+static const DECLARE_TLV_DB_LINEAR(tascam_monitor_db_linear, TLV_DB_GAIN_MUTE, 0);
+
+/* Linear gain of each input in the monitor mix, one value per input */
+static const struct snd_kcontrol_new tascam_monitor_volume_ctl = {
+	.iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+	.name = "Monitor Playback Volume",
+	.access = SNDRV_CTL_ELEM_ACCESS_READWRITE | SNDRV_CTL_ELEM_ACCESS_TLV_READ,
+	.info = tascam_monitor_volume_info,
+	.get = tascam_monitor_volume_get,
+	.put = tascam_monitor_volume_put,
+	.tlv = { .p = tascam_monitor_db_linear },
+};
+
+/**
+ * tascam_create_controls() - register the card's ALSA controls
+ * @tascam: the tascam_card instance
+ *
+ * Return: 0 on success, or a negative error code on failure.
+ */
+int tascam_create_controls(struct tascam_card *tascam)
+{
+	int err;
+
+	err = snd_ctl_add(tascam->card, snd_ctl_new1(&tascam_measured_rate_ctl, tascam));
+	if (err < 0)
+		return err;
+
+	err = snd_ctl_add(tascam->card, snd_ctl_new1(&tascam_duplex_offset_ctl, tascam));
+	if (err < 0)
+		return err;
+
+	err = snd_ctl_add(tascam->card, snd_ctl_new1(&tascam_capture_pair_ctl, tascam));
+	if (err < 0)
+		return err;
+
+	err = snd_ctl_add(tascam->card, snd_ctl_new1(&tascam_monitor_switch_ctl, tascam));
+	if (err < 0)
+		return err;
+
+	return snd_ctl_add(tascam->card, snd_ctl_new1(&tascam_monitor_volume_ctl, tascam));
+}
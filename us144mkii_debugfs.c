@@ -0,0 +1,282 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (c) 2025 Šerif Rami <ramiserifpersia@gmail.com>
+
+#include <linux/bitops.h>
+#include <linux/debugfs.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include "us144mkii.h"
+
+#define TASCAM_HIST_BUCKETS 16
+#define TASCAM_ACTIVE_BUCKETS 32
+
+/* Gaps are bucketed in ~1 us units, handler times in 256 ns units */
+#define TASCAM_GAP_SHIFT 10
+#define TASCAM_HANDLER_SHIFT 8
+
+/**
+ * struct tascam_ep_stats - per-CPU completion statistics of one endpoint
+ * @completed: URBs completed successfully
+ * @failed: URBs completed with an error status
+ * @gap_hist: log2 histogram of the time between completions
+ * @handler_hist: log2 histogram of the time spent in the completion handler
+ * @handler_ns_total: total time spent in the completion handler
+ * @handler_ns_min: shortest completion handler run
+ * @handler_ns_max: longest completion handler run
+ */
+struct tascam_ep_stats {
+	u64 completed;
+	u64 failed;
+	u64 gap_hist[TASCAM_HIST_BUCKETS];
+	u64 handler_hist[TASCAM_HIST_BUCKETS];
+	u64 handler_ns_total;
+	u64 handler_ns_min;
+	u64 handler_ns_max;
+};
+
+/**
+ * struct tascam_stats - per-CPU statistics of one card
+ * @ep: completion statistics per endpoint
+ * @active_hist: histogram of active_urbs, sampled at every completion
+ * @feedback_count: feedback samples accepted by the rate estimator
+ * @feedback_rejected: feedback samples rejected as out of range
+ * @feedback_min: smallest accepted feedback sample, in Q16.16 frames
+ * @feedback_max: largest accepted feedback sample, in Q16.16 frames
+ * @feedback_sum: sum of accepted feedback samples, in Q16.16 frames
+ * @clamps: packets clamped to MAX_FRAMES_PER_PACKET
+ */
+struct tascam_stats {
+	struct tascam_ep_stats ep[TASCAM_STATS_EP_COUNT];
+	u64 active_hist[TASCAM_ACTIVE_BUCKETS];
+	u64 feedback_count;
+	u64 feedback_rejected;
+	u32 feedback_min;
+	u32 feedback_max;
+	u64 feedback_sum;
+	u64 clamps;
+};
+
+static const char * const tascam_stats_ep_names[TASCAM_STATS_EP_COUNT] = {
+	[TASCAM_STATS_PLAYBACK] = "playback",
+	[TASCAM_STATS_FEEDBACK] = "feedback",
+	[TASCAM_STATS_CAPTURE] = "capture",
+};
+
+static unsigned int tascam_hist_bucket(u64 ns, unsigned int shift)
+{
+	return min_t(unsigned int, fls64(ns >> shift), TASCAM_HIST_BUCKETS - 1);
+}
+
+/**
+ * tascam_stats_complete() - account one URB completion
+ * @tascam: the tascam_card instance
+ * @ep: the endpoint the URB belongs to
+ * @status: the URB status
+ * @start_ns: value of tascam_stats_begin() at handler entry
+ *
+ * Called at the end of a completion handler. Everything but the time of
+ * the previous completion lives in per-CPU storage.
+ */
+void tascam_stats_complete(struct tascam_card *tascam, enum tascam_stats_ep ep,
+			   int status, u64 start_ns)
+{
+	struct tascam_stats *stats;
+	struct tascam_ep_stats *es;
+	u64 now = ktime_get_ns();
+	u64 handler_ns = now - start_ns;
+	u64 last;
+
+	if (!tascam->stats)
+		return;
+
+	last = atomic64_xchg(&tascam->stats_last_ns[ep], start_ns);
+
+	stats = get_cpu_ptr(tascam->stats);
+	es = &stats->ep[ep];
+	if (status)
+		es->failed++;
+	else
+		es->completed++;
+	if (last)
+		es->gap_hist[tascam_hist_bucket(start_ns - last, TASCAM_GAP_SHIFT)]++;
+	es->handler_hist[tascam_hist_bucket(handler_ns, TASCAM_HANDLER_SHIFT)]++;
+	es->handler_ns_total += handler_ns;
+	if (handler_ns < es->handler_ns_min)
+		es->handler_ns_min = handler_ns;
+	if (handler_ns > es->handler_ns_max)
+		es->handler_ns_max = handler_ns;
+	stats->active_hist[clamp(atomic_read(&tascam->active_urbs), 0,
+				 TASCAM_ACTIVE_BUCKETS - 1)]++;
+	put_cpu_ptr(tascam->stats);
+}
+
+/**
+ * tascam_stats_feedback() - account one feedback sample
+ * @tascam: the tascam_card instance
+ * @sample_q16: the sample, in Q16.16 frames per microframe
+ * @accepted: whether the rate estimator used the sample
+ */
+void tascam_stats_feedback(struct tascam_card *tascam, u32 sample_q16, bool accepted)
+{
+	struct tascam_stats *stats;
+
+	if (!tascam->stats)
+		return;
+
+	stats = get_cpu_ptr(tascam->stats);
+	if (accepted) {
+		stats->feedback_count++;
+		stats->feedback_sum += sample_q16;
+		if (sample_q16 < stats->feedback_min)
+			stats->feedback_min = sample_q16;
+		if (sample_q16 > stats->feedback_max)
+			stats->feedback_max = sample_q16;
+	} else {
+		stats->feedback_rejected++;
+	}
+	put_cpu_ptr(tascam->stats);
+}
+
+/**
+ * tascam_stats_clamp() - account one packet clamped to MAX_FRAMES_PER_PACKET
+ * @tascam: the tascam_card instance
+ */
+void tascam_stats_clamp(struct tascam_card *tascam)
+{
+	if (tascam->stats)
+		this_cpu_inc(tascam->stats->clamps);
+}
+
+static void tascam_stats_print_hist(struct seq_file *m, const char *name,
+				    const u64 *hist, unsigned int shift)
+{
+	unsigned int i;
+
+	seq_printf(m, "  %s:", name);
+	for (i = 0; i < TASCAM_HIST_BUCKETS; i++)
+		seq_printf(m, " %llu", hist[i]);
+	seq_printf(m, " (bucket n < %u ns << n)\n", 1U << shift);
+}
+
+static int tascam_stats_show(struct seq_file *m, void *v)
+{
+	struct tascam_card *tascam = m->private;
+	struct tascam_stats *sum;
+	const struct tascam_stats *st;
+	unsigned int e, i;
+	u64 count;
+	int cpu;
+
+	sum = kzalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+
+	for (e = 0; e < TASCAM_STATS_EP_COUNT; e++)
+		sum->ep[e].handler_ns_min = U64_MAX;
+	sum->feedback_min = U32_MAX;
+
+	for_each_possible_cpu(cpu) {
+		st = per_cpu_ptr(tascam->stats, cpu);
+		for (e = 0; e < TASCAM_STATS_EP_COUNT; e++) {
+			sum->ep[e].completed += st->ep[e].completed;
+			sum->ep[e].failed += st->ep[e].failed;
+			for (i = 0; i < TASCAM_HIST_BUCKETS; i++) {
+				sum->ep[e].gap_hist[i] += st->ep[e].gap_hist[i];
+				sum->ep[e].handler_hist[i] += st->ep[e].handler_hist[i];
+			}
+			sum->ep[e].handler_ns_total += st->ep[e].handler_ns_total;
+			sum->ep[e].handler_ns_min = min(sum->ep[e].handler_ns_min,
+							st->ep[e].handler_ns_min);
+			sum->ep[e].handler_ns_max = max(sum->ep[e].handler_ns_max,
+							st->ep[e].handler_ns_max);
+		}
+		for (i = 0; i < TASCAM_ACTIVE_BUCKETS; i++)
+			sum->active_hist[i] += st->active_hist[i];
+		sum->feedback_count += st->feedback_count;
+		sum->feedback_rejected += st->feedback_rejected;
+		sum->feedback_sum += st->feedback_sum;
+		sum->feedback_min = min(sum->feedback_min, st->feedback_min);
+		sum->feedback_max = max(sum->feedback_max, st->feedback_max);
+		sum->clamps += st->clamps;
+	}
+
+	for (e = 0; e < TASCAM_STATS_EP_COUNT; e++) {
+		const struct tascam_ep_stats *es = &sum->ep[e];
+
+		count = es->completed + es->failed;
+		seq_printf(m, "%s:\n", tascam_stats_ep_names[e]);
+		seq_printf(m, "  completed: %llu\n", es->completed);
+		seq_printf(m, "  failed: %llu\n", es->failed);
+		seq_printf(m, "  handler ns min/avg/max: %llu/%llu/%llu\n",
+			   count ? es->handler_ns_min : 0,
+			   count ? div64_u64(es->handler_ns_total, count) : 0,
+			   es->handler_ns_max);
+		tascam_stats_print_hist(m, "gap", es->gap_hist, TASCAM_GAP_SHIFT);
+		tascam_stats_print_hist(m, "handler", es->handler_hist, TASCAM_HANDLER_SHIFT);
+	}
+
+	seq_puts(m, "active urbs:");
+	for (i = 0; i < TASCAM_ACTIVE_BUCKETS; i++)
+		seq_printf(m, " %llu", sum->active_hist[i]);
+	seq_puts(m, "\n");
+
+	seq_printf(m, "feedback accepted: %llu\n", sum->feedback_count);
+	seq_printf(m, "feedback rejected: %llu\n", sum->feedback_rejected);
+	seq_printf(m, "feedback q16 min/avg/max: %u/%llu/%u\n",
+		   sum->feedback_count ? sum->feedback_min : 0,
+		   sum->feedback_count ? div64_u64(sum->feedback_sum, sum->feedback_count) : 0,
+		   sum->feedback_max);
+	seq_printf(m, "packet clamps: %llu\n", sum->clamps);
+
+	kfree(sum);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(tascam_stats);
+
+/**
+ * tascam_debugfs_init() - allocate statistics and create the debugfs files
+ * @tascam: the tascam_card instance
+ *
+ * The statistics appear in /sys/kernel/debug/us144mkii-<card>/stats.
+ *
+ * Return: 0 on success, or -ENOMEM if the per-CPU counters can't be
+ * allocated.
+ */
+int tascam_debugfs_init(struct tascam_card *tascam)
+{
+	struct tascam_stats *st;
+	char name[24];
+	unsigned int e;
+	int cpu;
+
+	tascam->stats = alloc_percpu(struct tascam_stats);
+	if (!tascam->stats)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		st = per_cpu_ptr(tascam->stats, cpu);
+		for (e = 0; e < TASCAM_STATS_EP_COUNT; e++)
+			st->ep[e].handler_ns_min = U64_MAX;
+		st->feedback_min = U32_MAX;
+	}
+
+	snprintf(name, sizeof(name), DRIVER_NAME "-card%d", tascam->card->number);
+	tascam->debugfs_dir = debugfs_create_dir(name, NULL);
+	debugfs_create_file("stats", 0444, tascam->debugfs_dir, tascam, &tascam_stats_fops);
+	debugfs_create_atomic_t("active_urbs", 0444, tascam->debugfs_dir, &tascam->active_urbs);
+	return 0;
+}
+
+/**
+ * tascam_debugfs_exit() - remove the debugfs files and free the statistics
+ * @tascam: the tascam_card instance
+ *
+ * Must be called after all URBs have been killed.
+ */
+void tascam_debugfs_exit(struct tascam_card *tascam)
+{
+	debugfs_remove_recursive(tascam->debugfs_dir);
+	tascam->debugfs_dir = NULL;
+	free_percpu(tascam->stats);
+	tascam->stats = NULL;
+}
@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+// Copyright (c) 2025 Šerif Rami <ramiserifpersia@gmail.com>
+
+#ifndef __US144MKII_DEBUGFS_H
+#define __US144MKII_DEBUGFS_H
+
+#include <linux/ktime.h>
+#include <linux/types.h>
+
+struct tascam_card;
+struct tascam_stats;
+
+/**
+ * enum tascam_stats_ep - endpoints with separate completion statistics
+ * @TASCAM_STATS_PLAYBACK: isochronous audio OUT
+ * @TASCAM_STATS_FEEDBACK: isochronous feedback IN
+ * @TASCAM_STATS_CAPTURE: bulk audio IN
+ * @TASCAM_STATS_EP_COUNT: number of tracked endpoints
+ */
+enum tascam_stats_ep {
+	TASCAM_STATS_PLAYBACK,
+	TASCAM_STATS_FEEDBACK,
+	TASCAM_STATS_CAPTURE,
+	TASCAM_STATS_EP_COUNT,
+};
+
+#ifdef CONFIG_DEBUG_FS
+
+int tascam_debugfs_init(struct tascam_card *tascam);
+void tascam_debugfs_exit(struct tascam_card *tascam);
+void tascam_stats_complete(struct tascam_card *tascam, enum tascam_stats_ep ep,
+			   int status, u64 start_ns);
+void tascam_stats_feedback(struct tascam_card *tascam, u32 sample_q16, bool accepted);
+void tascam_stats_clamp(struct tascam_card *tascam);
+
+static inline u64 tascam_stats_begin(void)
+{
+	return ktime_get_ns();
+}
+
+#else
+
+static inline int tascam_debugfs_init(struct tascam_card *tascam) { return 0; }
+static inline void tascam_debugfs_exit(struct tascam_card *tascam) { }
+static inline void tascam_stats_complete(struct tascam_card *tascam, enum tascam_stats_ep ep,
+					 int status, u64 start_ns) { }
+static inline void tascam_stats_feedback(struct tascam_card *tascam, u32 sample_q16,
+					 bool accepted) { }
+static inline void tascam_stats_clamp(struct tascam_card *tascam) { }
+static inline u64 tascam_stats_begin(void) { return 0; }
+
+#endif /* CONFIG_DEBUG_FS */
+
+#endif /* __US144MKII_DEBUGFS_H */
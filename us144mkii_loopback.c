@@ -0,0 +1,175 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (c) 2025 Šerif Rami <ramiserifpersia@gmail.com>
+
+#include "us144mkii_pcm.h"
+
+/*
+ * The loopback subdevice hands back the playback URBs byte for byte, so it
+ * only offers the layout the device is fed with.
+ */
+const struct snd_pcm_hardware tascam_loopback_hw = {
+	.info = (SNDRV_PCM_INFO_MMAP | SNDRV_PCM_INFO_INTERLEAVED |
+	SNDRV_PCM_INFO_BLOCK_TRANSFER | SNDRV_PCM_INFO_MMAP_VALID |
+	SNDRV_PCM_INFO_PAUSE | SNDRV_PCM_INFO_RESUME |
+	SNDRV_PCM_INFO_NO_PERIOD_WAKEUP),
+	.formats = SNDRV_PCM_FMTBIT_S24_3LE,
+	.rates = (SNDRV_PCM_RATE_44100 | SNDRV_PCM_RATE_48000 |
+	SNDRV_PCM_RATE_88200 | SNDRV_PCM_RATE_96000),
+	.rate_min = 44100,
+	.rate_max = 96000,
+	.channels_min = NUM_CHANNELS,
+	.channels_max = NUM_CHANNELS,
+	.buffer_bytes_max = 1024 * 1024,
+	.period_bytes_min = 48 * PLAYBACK_FRAME_SIZE,
+	.period_bytes_max = 1024 * 1024,
+	.periods_min = 2,
+	.periods_max = 1024,
+};
+
+/**
+ * tascam_loopback_copy() - tap an outgoing playback URB
+ * @tascam: the tascam_card instance
+ * @src: the URB buffer as it is about to be submitted
+ * @frames: number of frames in @src
+ *
+ * Called from the playback completion for every URB, ghost silence
+ * included, so the loopback stream runs off the device clock whether or
+ * not anything is playing. The copy is done under loopback_lock so that
+ * sync_stop can wait for it before the ring goes away.
+ */
+void tascam_loopback_copy(struct tascam_card *tascam, const u8 *src, unsigned int frames)
+{
+	struct snd_pcm_substream *substream;
+	struct snd_pcm_runtime *runtime;
+	snd_pcm_uframes_t pos;
+	unsigned int part1;
+	bool need_period_elapsed = false;
+	unsigned long flags;
+
+	if (!atomic_read(&tascam->loopback_active) || !frames)
+		return;
+
+	spin_lock_irqsave(&tascam->loopback_lock, flags);
+	substream = tascam->loopback_substream;
+	if (!atomic_read(&tascam->loopback_active) || !substream || !substream->runtime) {
+		spin_unlock_irqrestore(&tascam->loopback_lock, flags);
+		return;
+	}
+	runtime = substream->runtime;
+	pos = tascam->loopback_pos;
+
+	part1 = min_t(unsigned int, frames, runtime->buffer_size - pos);
+	memcpy(runtime->dma_area + frames_to_bytes(runtime, pos), src, part1 * PLAYBACK_FRAME_SIZE);
+	if (part1 < frames)
+		memcpy(runtime->dma_area, src + part1 * PLAYBACK_FRAME_SIZE,
+		       (frames - part1) * PLAYBACK_FRAME_SIZE);
+
+	WRITE_ONCE(tascam->loopback_pos, (pos + frames) % runtime->buffer_size);
+	tascam->loopback_frames += frames;
+	if (div_u64(tascam->loopback_frames, runtime->period_size) > tascam->last_lb_period_pos) {
+		tascam->last_lb_period_pos = div_u64(tascam->loopback_frames, runtime->period_size);
+		need_period_elapsed = !runtime->no_period_wakeup;
+	}
+	spin_unlock_irqrestore(&tascam->loopback_lock, flags);
+
+	if (need_period_elapsed)
+		snd_pcm_period_elapsed(substream);
+}
+
+static int tascam_loopback_open(struct snd_pcm_substream *substream)
+{
+	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
+	unsigned long flags;
+
+	substream->runtime->hw = tascam_loopback_hw;
+	tascam_pcm_constrain_rate(substream);
+	spin_lock_irqsave(&tascam->loopback_lock, flags);
+	tascam->loopback_substream = substream;
+	atomic_set(&tascam->loopback_active, 0);
+	spin_unlock_irqrestore(&tascam->loopback_lock, flags);
+	return 0;
+}
+
+static int tascam_loopback_close(struct snd_pcm_substream *substream)
+{
+	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
+	unsigned long flags;
+
+	spin_lock_irqsave(&tascam->loopback_lock, flags);
+	atomic_set(&tascam->loopback_active, 0);
+	tascam->loopback_substream = NULL;
+	spin_unlock_irqrestore(&tascam->loopback_lock, flags);
+	return 0;
+}
+
+static int tascam_loopback_prepare(struct snd_pcm_substream *substream)
+{
+	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
+	unsigned long flags;
+	int err;
+
+	err = tascam_wait_init(tascam);
+	if (err < 0)
+		return err;
+
+	spin_lock_irqsave(&tascam->loopback_lock, flags);
+	tascam->loopback_pos = 0;
+	tascam->loopback_frames = 0;
+	tascam->last_lb_period_pos = 0;
+	spin_unlock_irqrestore(&tascam->loopback_lock, flags);
+	return 0;
+}
+
+static int tascam_loopback_trigger(struct snd_pcm_substream *substream, int cmd)
+{
+	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
+
+	switch (cmd) {
+	case SNDRV_PCM_TRIGGER_RESUME:
+		if (!completion_done(&tascam->init_done))
+			return -EAGAIN;
+		fallthrough;
+	case SNDRV_PCM_TRIGGER_START:
+	case SNDRV_PCM_TRIGGER_PAUSE_RELEASE:
+		if (!atomic_xchg(&tascam->loopback_active, 1))
+			us144mkii_maybe_start_stream(tascam);
+		return 0;
+	case SNDRV_PCM_TRIGGER_STOP:
+	case SNDRV_PCM_TRIGGER_SUSPEND:
+	case SNDRV_PCM_TRIGGER_PAUSE_PUSH:
+		if (atomic_xchg(&tascam->loopback_active, 0))
+			us144mkii_maybe_stop_stream(tascam);
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
+/* Wait out a copy that saw the stream still running */
+static int tascam_loopback_sync_stop(struct snd_pcm_substream *substream)
+{
+	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
+	unsigned long flags;
+
+	spin_lock_irqsave(&tascam->loopback_lock, flags);
+	spin_unlock_irqrestore(&tascam->loopback_lock, flags);
+	return 0;
+}
+
+static snd_pcm_uframes_t tascam_loopback_pointer(struct snd_pcm_substream *substream)
+{
+	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
+
+	return READ_ONCE(tascam->loopback_pos);
+}
+
+const struct snd_pcm_ops tascam_loopback_ops = {
+	.open = tascam_loopback_open,
+	.close = tascam_loopback_close,
+	.ioctl = snd_pcm_lib_ioctl,
+	.hw_params = tascam_pcm_hw_params,
+	.prepare = tascam_loopback_prepare,
+	.trigger = tascam_loopback_trigger,
+	.sync_stop = tascam_loopback_sync_stop,
+	.pointer = tascam_loopback_pointer,
+};
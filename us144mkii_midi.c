@@ -3,38 +3,91 @@
 
 #include "us144mkii.h"
 
-static void tascam_midi_out_complete(struct urb *urb)
+/*
+ * Pack up to MIDI_OUT_URB_PACKETS device packets into @buf, each holding
+ * 8 bytes from the rawmidi buffer padded with 0xFD and closed with 0xE0.
+ * Returns the number of MIDI bytes taken.
+ */
+static int tascam_midi_out_fill(struct snd_rawmidi_substream *sub, u8 *buf, int *packets)
 {
-	struct tascam_card *tascam = urb->context;
-	struct snd_rawmidi_substream *sub = tascam->midi_output;
-	unsigned long flags;
-	int count;
-
-	spin_lock_irqsave(&tascam->midi_lock, flags);
-
-	if (urb->status || !sub || !tascam->midi_out_active) {
-		tascam->midi_out_active = false;
-		spin_unlock_irqrestore(&tascam->midi_lock, flags);
-		return;
+	int count, total = 0;
+
+	for (*packets = 0; *packets < MIDI_OUT_URB_PACKETS; (*packets)++, buf += MIDI_PACKET_SIZE) {
+		count = snd_rawmidi_transmit(sub, buf, MIDI_PAYLOAD_SIZE);
+		if (count <= 0)
+			break;
+		if (count < MIDI_PAYLOAD_SIZE)
+			memset(buf + count, 0xFD, MIDI_PAYLOAD_SIZE - count);
+		buf[MIDI_PAYLOAD_SIZE] = 0xE0;
+		total += count;
 	}
+	return total;
+}
 
-	count = snd_rawmidi_transmit(sub, tascam->midi_out_buf, 8);
-	if (count > 0) {
-		if (count < 8)
-			memset(tascam->midi_out_buf + count, 0xFD, 8 - count);
+/*
+ * Hand the device as many URBs as are idle, but never more than
+ * MIDI_OUT_AHEAD_BYTES ahead of what the DIN port has sent at 31250 baud;
+ * past that, the timer retries once the wire has caught up. Caller holds
+ * midi_lock.
+ */
+static void tascam_midi_out_kick(struct tascam_card *tascam)
+{
+	struct snd_rawmidi_substream *sub = tascam->midi_output;
+	u64 now = ktime_get_ns(), ahead;
+	struct urb *urb;
+	int i, bytes, packets;
+
+	if (tascam->midi_out_wire_ns < now)
+		tascam->midi_out_wire_ns = now;
+
+	while (sub && tascam->midi_out_idle && !tascam->midi_out_halted) {
+		ahead = tascam->midi_out_wire_ns - now;
+		if (ahead > (u64)MIDI_OUT_AHEAD_BYTES * MIDI_WIRE_BYTE_NS) {
+			ahead -= (u64)MIDI_OUT_AHEAD_BYTES * MIDI_WIRE_BYTE_NS;
+			mod_timer(&tascam->midi_out_timer, jiffies + nsecs_to_jiffies(ahead) + 1);
+			break;
+		}
 
-		tascam->midi_out_buf[8] = 0xE0;
-		urb->transfer_buffer_length = 9;
+		i = __ffs(tascam->midi_out_idle);
+		urb = tascam->midi_out_urbs[i];
+		bytes = tascam_midi_out_fill(sub, urb->transfer_buffer, &packets);
+		if (!bytes)
+			break;
 
+		urb->transfer_buffer_length = packets * MIDI_PACKET_SIZE;
 		usb_anchor_urb(urb, &tascam->midi_anchor);
 		if (usb_submit_urb(urb, GFP_ATOMIC) < 0) {
 			usb_unanchor_urb(urb);
-			tascam->midi_out_active = false;
+			break;
 		}
-	} else {
-		tascam->midi_out_active = false;
+		tascam->midi_out_idle &= ~BIT(i);
+		tascam->midi_out_wire_ns += (u64)bytes * MIDI_WIRE_BYTE_NS;
 	}
+}
 
+static void tascam_midi_out_complete(struct urb *urb)
+{
+	struct tascam_card *tascam = urb->context;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&tascam->midi_lock, flags);
+	for (i = 0; i < MIDI_OUT_URBS; i++) {
+		if (tascam->midi_out_urbs[i] == urb)
+			tascam->midi_out_idle |= BIT(i);
+	}
+	if (!urb->status)
+		tascam_midi_out_kick(tascam);
+	spin_unlock_irqrestore(&tascam->midi_lock, flags);
+}
+
+static void tascam_midi_out_timer(struct timer_list *t)
+{
+	struct tascam_card *tascam = container_of(t, struct tascam_card, midi_out_timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(&tascam->midi_lock, flags);
+	tascam_midi_out_kick(tascam);
 	spin_unlock_irqrestore(&tascam->midi_lock, flags);
 }
 
@@ -42,36 +95,55 @@ static void tascam_midi_output_trigger(struct snd_rawmidi_substream *sub, int up
 {
 	struct tascam_card *tascam = sub->rmidi->private_data;
 	unsigned long flags;
-	int count;
 
 	spin_lock_irqsave(&tascam->midi_lock, flags);
 	if (up) {
 		tascam->midi_output = sub;
-		if (!tascam->midi_out_active) {
-			tascam->midi_out_active = true;
-			count = snd_rawmidi_transmit(sub, tascam->midi_out_buf, 8);
-			if (count > 0) {
-				if (count < 8)
-					memset(tascam->midi_out_buf + count, 0xFD, 8 - count);
-
-				tascam->midi_out_buf[8] = 0xE0;
-				tascam->midi_out_urb->transfer_buffer_length = 9;
-
-				usb_anchor_urb(tascam->midi_out_urb, &tascam->midi_anchor);
-				if (usb_submit_urb(tascam->midi_out_urb, GFP_ATOMIC) < 0) {
-					usb_unanchor_urb(tascam->midi_out_urb);
-					tascam->midi_out_active = false;
-				}
-			} else {
-				tascam->midi_out_active = false;
-			}
-		}
+		tascam_midi_out_kick(tascam);
 	} else {
 		tascam->midi_output = NULL;
 	}
 	spin_unlock_irqrestore(&tascam->midi_lock, flags);
 }
 
+/**
+ * tascam_midi_out_halt() - stop MIDI output for suspend or disconnect
+ * @tascam: the tascam_card instance
+ *
+ * Keeps completions and the pacing timer from submitting more URBs, so the
+ * caller can kill the MIDI anchor for good. tascam_midi_out_resume() lets
+ * output continue from where it stopped.
+ */
+void tascam_midi_out_halt(struct tascam_card *tascam)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&tascam->midi_lock, flags);
+	tascam->midi_out_halted = true;
+	spin_unlock_irqrestore(&tascam->midi_lock, flags);
+	timer_delete_sync(&tascam->midi_out_timer);
+}
+
+/**
+ * tascam_midi_out_resume() - restart MIDI output after tascam_midi_out_halt()
+ * @tascam: the tascam_card instance
+ */
+void tascam_midi_out_resume(struct tascam_card *tascam)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&tascam->midi_lock, flags);
+	tascam->midi_out_halted = false;
+	tascam_midi_out_kick(tascam);
+	spin_unlock_irqrestore(&tascam->midi_lock, flags);
+}
+
+/*
+ * Several input URBs stay queued on the endpoint, so the device always has
+ * one to complete while another is being handed to rawmidi. Bytes are
+ * passed on from the completion itself, which is where a rawmidi stream
+ * opened in timestamp framing mode gets its stamps from.
+ */
 static void tascam_midi_in_complete(struct urb *urb)
 {
 	struct tascam_card *tascam = urb->context;
@@ -98,6 +170,28 @@ static void tascam_midi_in_complete(struct urb *urb)
 		usb_unanchor_urb(urb);
 }
 
+/**
+ * tascam_midi_in_start() - queue all MIDI input URBs
+ * @tascam: the tascam_card instance
+ *
+ * Return: 0 on success, or -EIO with no input URB left queued.
+ */
+int tascam_midi_in_start(struct tascam_card *tascam)
+{
+	int i;
+
+	for (i = 0; i < MIDI_IN_URBS; i++) {
+		usb_anchor_urb(tascam->midi_in_urbs[i], &tascam->midi_anchor);
+		if (usb_submit_urb(tascam->midi_in_urbs[i], GFP_KERNEL) < 0) {
+			usb_unanchor_urb(tascam->midi_in_urbs[i]);
+			while (i--)
+				usb_kill_urb(tascam->midi_in_urbs[i]);
+			return -EIO;
+		}
+	}
+	return 0;
+}
+
 static void tascam_midi_input_trigger(struct snd_rawmidi_substream *sub, int up)
 {
 	struct tascam_card *tascam = sub->rmidi->private_data;
@@ -111,21 +205,23 @@ static void tascam_midi_input_trigger(struct snd_rawmidi_substream *sub, int up)
 static int tascam_midi_open(struct snd_rawmidi_substream *substream)
 {
 	struct tascam_card *tascam = substream->rmidi->private_data;
-	int err = 0;
+	int err;
+
+	err = tascam_wait_init(tascam);
+	if (err < 0)
+		return err;
 
 	us144mkii_maybe_start_stream(tascam);
 
 	if (substream->stream == SNDRV_RAWMIDI_STREAM_OUTPUT) {
 		unsigned long flags;
 		spin_lock_irqsave(&tascam->midi_lock, flags);
-		tascam->midi_out_active = false;
+		tascam->midi_out_wire_ns = 0;
 		spin_unlock_irqrestore(&tascam->midi_lock, flags);
 	} else {
-		usb_anchor_urb(tascam->midi_in_urb, &tascam->midi_anchor);
-		if (usb_submit_urb(tascam->midi_in_urb, GFP_KERNEL) < 0) {
-			usb_unanchor_urb(tascam->midi_in_urb);
-			err = -EIO;
-		}
+		err = tascam_midi_in_start(tascam);
+		if (!err)
+			tascam->midi_in_open = true;
 	}
 
 	if (err < 0)
@@ -137,9 +233,15 @@ static int tascam_midi_open(struct snd_rawmidi_substream *substream)
 static int tascam_midi_close(struct snd_rawmidi_substream *substream)
 {
 	struct tascam_card *tascam = substream->rmidi->private_data;
+	int i;
 
-	if (substream->stream == SNDRV_RAWMIDI_STREAM_INPUT)
-		usb_kill_urb(tascam->midi_in_urb);
+	if (substream->stream == SNDRV_RAWMIDI_STREAM_INPUT) {
+		tascam->midi_in_open = false;
+		for (i = 0; i < MIDI_IN_URBS; i++)
+			usb_kill_urb(tascam->midi_in_urbs[i]);
+	} else {
+		timer_delete_sync(&tascam->midi_out_timer);
+	}
 
 	us144mkii_maybe_stop_stream(tascam);
 	return 0;
@@ -166,7 +268,7 @@ static const struct snd_rawmidi_ops midi_in_ops = {
 int tascam_create_midi(struct tascam_card *tascam)
 {
 	struct snd_rawmidi *rmidi;
-	int err;
+	int err, i;
 	char midi_name[48];
 	const char *model_name = (tascam->dev_id == USB_PID_TASCAM_US144) ? "US-144" : "US-144MKII";
 
@@ -186,29 +288,37 @@ int tascam_create_midi(struct tascam_card *tascam)
 	SNDRV_RAWMIDI_INFO_DUPLEX;
 	tascam->rmidi = rmidi;
 
-	tascam->midi_out_urb = usb_alloc_urb(0, GFP_KERNEL);
-	tascam->midi_in_urb = usb_alloc_urb(0, GFP_KERNEL);
-	if (!tascam->midi_out_urb || !tascam->midi_in_urb)
-		return -ENOMEM;
-
-	tascam->midi_out_buf = usb_alloc_coherent(tascam->dev, MIDI_PACKET_SIZE,
-											  GFP_KERNEL, &tascam->midi_out_urb->transfer_dma);
-	tascam->midi_in_buf = usb_alloc_coherent(tascam->dev, MIDI_PACKET_SIZE,
-											 GFP_KERNEL, &tascam->midi_in_urb->transfer_dma);
-	if (!tascam->midi_out_buf || !tascam->midi_in_buf)
-		return -ENOMEM;
-
-	usb_fill_bulk_urb(tascam->midi_out_urb, tascam->dev,
-					  usb_sndbulkpipe(tascam->dev, EP_MIDI_OUT),
-					  tascam->midi_out_buf, MIDI_PACKET_SIZE,
-				   tascam_midi_out_complete, tascam);
-	tascam->midi_out_urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
-
-	usb_fill_bulk_urb(tascam->midi_in_urb, tascam->dev,
-					  usb_rcvbulkpipe(tascam->dev, EP_MIDI_IN),
-					  tascam->midi_in_buf, MIDI_PACKET_SIZE,
-				   tascam_midi_in_complete, tascam);
-	tascam->midi_in_urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+	for (i = 0; i < MIDI_OUT_URBS; i++) {
+		struct urb *urb = usb_alloc_urb(0, GFP_KERNEL);
+		void *buf;
+
+		if (!urb)
+			return -ENOMEM;
+		tascam->midi_out_urbs[i] = urb;
+		buf = usb_alloc_coherent(tascam->dev, MIDI_OUT_URB_SIZE, GFP_KERNEL, &urb->transfer_dma);
+		if (!buf)
+			return -ENOMEM;
+		usb_fill_bulk_urb(urb, tascam->dev, usb_sndbulkpipe(tascam->dev, EP_MIDI_OUT),
+				  buf, MIDI_OUT_URB_SIZE, tascam_midi_out_complete, tascam);
+		urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+	}
+	tascam->midi_out_idle = BIT(MIDI_OUT_URBS) - 1;
+	timer_setup(&tascam->midi_out_timer, tascam_midi_out_timer, 0);
+
+	for (i = 0; i < MIDI_IN_URBS; i++) {
+		struct urb *urb = usb_alloc_urb(0, GFP_KERNEL);
+		void *buf;
+
+		if (!urb)
+			return -ENOMEM;
+		tascam->midi_in_urbs[i] = urb;
+		buf = usb_alloc_coherent(tascam->dev, MIDI_PACKET_SIZE, GFP_KERNEL, &urb->transfer_dma);
+		if (!buf)
+			return -ENOMEM;
+		usb_fill_bulk_urb(urb, tascam->dev, usb_rcvbulkpipe(tascam->dev, EP_MIDI_IN),
+				  buf, MIDI_PACKET_SIZE, tascam_midi_in_complete, tascam);
+		urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+	}
 
 	spin_lock_init(&tascam->midi_lock);
 	init_usb_anchor(&tascam->midi_anchor);
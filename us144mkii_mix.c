@@ -0,0 +1,262 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (c) 2025 Šerif Rami <ramiserifpersia@gmail.com>
+
+#include <linux/unaligned.h>
+#include "us144mkii_pcm.h"
+
+/*
+ * Playback subdevices past the first are summed into the URBs of the
+ * first one, so they carry no URB or clock state of their own and take
+ * whichever format and channel count the client prefers.
+ */
+const struct snd_pcm_hardware tascam_mix_hw = {
+	.info = (SNDRV_PCM_INFO_MMAP | SNDRV_PCM_INFO_INTERLEAVED |
+	SNDRV_PCM_INFO_BLOCK_TRANSFER | SNDRV_PCM_INFO_MMAP_VALID |
+	SNDRV_PCM_INFO_PAUSE | SNDRV_PCM_INFO_RESUME |
+	SNDRV_PCM_INFO_NO_PERIOD_WAKEUP),
+	.formats = (SNDRV_PCM_FMTBIT_S24_3LE | SNDRV_PCM_FMTBIT_S32_LE |
+	SNDRV_PCM_FMTBIT_S16_LE),
+	.rates = (SNDRV_PCM_RATE_44100 | SNDRV_PCM_RATE_48000 |
+	SNDRV_PCM_RATE_88200 | SNDRV_PCM_RATE_96000),
+	.rate_min = 44100,
+	.rate_max = 96000,
+	.channels_min = 2,
+	.channels_max = NUM_CHANNELS,
+	.buffer_bytes_max = 1024 * 1024,
+	.period_bytes_min = 48 * PLAYBACK_FRAME_SIZE,
+	.period_bytes_max = 1024 * 1024,
+	.periods_min = 2,
+	.periods_max = 1024,
+};
+
+static __always_inline s32 tascam_mix_load(const u8 *src, snd_pcm_format_t format)
+{
+	switch (format) {
+	case SNDRV_PCM_FORMAT_S32_LE:
+		return (s32)get_unaligned_le32(src) >> 8;
+	case SNDRV_PCM_FORMAT_S16_LE:
+		return (s32)(s16)get_unaligned_le16(src) << 8;
+	default:
+		return (s32)((src[0] << 8) | (src[1] << 16) | ((u32)src[2] << 24)) >> 8;
+	}
+}
+
+static __always_inline void __tascam_mix_frames(u8 *dst, const u8 *src, unsigned int frames,
+						unsigned int channels, snd_pcm_format_t format)
+{
+	unsigned int width = format == SNDRV_PCM_FORMAT_S32_LE ? 4 :
+			     format == SNDRV_PCM_FORMAT_S16_LE ? 2 : 3;
+	unsigned int i, ch;
+
+	for (i = 0; i < frames; i++, dst += PLAYBACK_FRAME_SIZE) {
+		for (ch = 0; ch < channels; ch++, src += width)
+			tascam_mix_s24(dst + ch * 3, tascam_mix_load(src, format));
+	}
+}
+
+static void tascam_mix_frames(struct snd_pcm_runtime *runtime, u8 *dst, snd_pcm_uframes_t pos,
+			      unsigned int frames)
+{
+	const u8 *src = runtime->dma_area + frames_to_bytes(runtime, pos);
+
+	switch (runtime->format) {
+	case SNDRV_PCM_FORMAT_S32_LE:
+		__tascam_mix_frames(dst, src, frames, runtime->channels, SNDRV_PCM_FORMAT_S32_LE);
+		break;
+	case SNDRV_PCM_FORMAT_S16_LE:
+		__tascam_mix_frames(dst, src, frames, runtime->channels, SNDRV_PCM_FORMAT_S16_LE);
+		break;
+	default:
+		__tascam_mix_frames(dst, src, frames, runtime->channels, SNDRV_PCM_FORMAT_S24_3LE);
+		break;
+	}
+}
+
+/**
+ * tascam_mix_playback() - sum the secondary playback subdevices into a URB
+ * @tascam: the tascam_card instance
+ * @dst: the URB buffer, already holding the first subdevice's frames
+ * @frames: number of frames in @dst
+ *
+ * Every running subdevice contributes @frames frames, so each one advances
+ * at the device rate as measured by the feedback endpoint, exactly like
+ * the first subdevice. Sums saturate at full scale.
+ */
+void tascam_mix_playback(struct tascam_card *tascam, u8 *dst, unsigned int frames)
+{
+	struct tascam_mix_stream *mix;
+	struct snd_pcm_runtime *runtime;
+	snd_pcm_uframes_t pos;
+	struct snd_pcm_substream *elapsed[TASCAM_PLAYBACK_SUBDEVICES - 1] = { NULL };
+	unsigned int i, part1;
+	unsigned long flags;
+	bool busy = false;
+
+	if (!atomic_read(&tascam->mix_streams_active) || !frames)
+		return;
+
+	spin_lock_irqsave(&tascam->mix_lock, flags);
+	for (i = 0; i < ARRAY_SIZE(tascam->mix_streams); i++) {
+		mix = &tascam->mix_streams[i];
+		if (!mix->active || !mix->substream || !mix->substream->runtime)
+			continue;
+
+		runtime = mix->substream->runtime;
+		pos = mix->pos;
+		part1 = min_t(unsigned int, frames, runtime->buffer_size - pos);
+		tascam_mix_frames(runtime, dst, pos, part1);
+		if (part1 < frames)
+			tascam_mix_frames(runtime, dst + part1 * PLAYBACK_FRAME_SIZE, 0, frames - part1);
+
+		WRITE_ONCE(mix->pos, (pos + frames) % runtime->buffer_size);
+		mix->frames_consumed += frames;
+		if (div_u64(mix->frames_consumed, runtime->period_size) > mix->last_period_pos) {
+			mix->last_period_pos = div_u64(mix->frames_consumed, runtime->period_size);
+			if (!runtime->no_period_wakeup)
+				elapsed[i] = mix->substream;
+		}
+		busy |= elapsed[i] != NULL;
+	}
+	/* Taken under the lock, so sync_stop and close see it once they hold it */
+	if (busy)
+		atomic_inc(&tascam->mix_elapsed_busy);
+	spin_unlock_irqrestore(&tascam->mix_lock, flags);
+
+	if (!busy)
+		return;
+	for (i = 0; i < ARRAY_SIZE(elapsed); i++) {
+		if (elapsed[i])
+			snd_pcm_period_elapsed(elapsed[i]);
+	}
+	if (atomic_dec_and_test(&tascam->mix_elapsed_busy))
+		wake_up(&tascam->mix_wait);
+}
+
+/* Wait out a mix pass on the stream, including its period notifications */
+static void tascam_mix_sync(struct tascam_card *tascam)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&tascam->mix_lock, flags);
+	spin_unlock_irqrestore(&tascam->mix_lock, flags);
+	wait_event(tascam->mix_wait, !atomic_read(&tascam->mix_elapsed_busy));
+}
+
+static struct tascam_mix_stream *tascam_mix_stream(struct snd_pcm_substream *substream)
+{
+	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
+
+	return &tascam->mix_streams[substream->number - 1];
+}
+
+static int tascam_mix_open(struct snd_pcm_substream *substream)
+{
+	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
+	struct tascam_mix_stream *mix = tascam_mix_stream(substream);
+	unsigned long flags;
+
+	substream->runtime->hw = tascam_mix_hw;
+	tascam_pcm_constrain_rate(substream);
+	spin_lock_irqsave(&tascam->mix_lock, flags);
+	mix->substream = substream;
+	mix->active = false;
+	spin_unlock_irqrestore(&tascam->mix_lock, flags);
+	return 0;
+}
+
+static int tascam_mix_close(struct snd_pcm_substream *substream)
+{
+	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
+	struct tascam_mix_stream *mix = tascam_mix_stream(substream);
+	unsigned long flags;
+
+	spin_lock_irqsave(&tascam->mix_lock, flags);
+	mix->substream = NULL;
+	spin_unlock_irqrestore(&tascam->mix_lock, flags);
+	tascam_mix_sync(tascam);
+	return 0;
+}
+
+static int tascam_mix_prepare(struct snd_pcm_substream *substream)
+{
+	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
+	struct tascam_mix_stream *mix = tascam_mix_stream(substream);
+	unsigned long flags;
+	int err;
+
+	err = tascam_wait_init(tascam);
+	if (err < 0)
+		return err;
+
+	spin_lock_irqsave(&tascam->mix_lock, flags);
+	mix->pos = 0;
+	mix->frames_consumed = 0;
+	mix->last_period_pos = 0;
+	spin_unlock_irqrestore(&tascam->mix_lock, flags);
+	return 0;
+}
+
+static int tascam_mix_trigger(struct snd_pcm_substream *substream, int cmd)
+{
+	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
+	struct tascam_mix_stream *mix = tascam_mix_stream(substream);
+	bool start = false, stop = false;
+	unsigned long flags;
+	int ret = 0;
+
+	if (cmd == SNDRV_PCM_TRIGGER_RESUME && !completion_done(&tascam->init_done))
+		return -EAGAIN;
+
+	spin_lock_irqsave(&tascam->mix_lock, flags);
+	switch (cmd) {
+	case SNDRV_PCM_TRIGGER_START:
+	case SNDRV_PCM_TRIGGER_RESUME:
+	case SNDRV_PCM_TRIGGER_PAUSE_RELEASE:
+		start = !mix->active;
+		mix->active = true;
+		break;
+	case SNDRV_PCM_TRIGGER_STOP:
+	case SNDRV_PCM_TRIGGER_SUSPEND:
+	case SNDRV_PCM_TRIGGER_PAUSE_PUSH:
+		stop = mix->active;
+		mix->active = false;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+	spin_unlock_irqrestore(&tascam->mix_lock, flags);
+
+	/* The first subdevice's URBs carry the mix, so keep them running */
+	if (start) {
+		atomic_inc(&tascam->mix_streams_active);
+		us144mkii_maybe_start_stream(tascam);
+	}
+	if (stop) {
+		atomic_dec(&tascam->mix_streams_active);
+		us144mkii_maybe_stop_stream(tascam);
+	}
+	return ret;
+}
+
+static int tascam_mix_sync_stop(struct snd_pcm_substream *substream)
+{
+	tascam_mix_sync(snd_pcm_substream_chip(substream));
+	return 0;
+}
+
+static snd_pcm_uframes_t tascam_mix_pointer(struct snd_pcm_substream *substream)
+{
+	return READ_ONCE(tascam_mix_stream(substream)->pos);
+}
+
+const struct snd_pcm_ops tascam_mix_ops = {
+	.open = tascam_mix_open,
+	.close = tascam_mix_close,
+	.ioctl = snd_pcm_lib_ioctl,
+	.hw_params = tascam_pcm_hw_params,
+	.prepare = tascam_mix_prepare,
+	.trigger = tascam_mix_trigger,
+	.sync_stop = tascam_mix_sync_stop,
+	.pointer = tascam_mix_pointer,
+};
@@ -16,19 +16,100 @@ static const struct rate_config rate_map[] = {
 	{ 96000, {0x00, 0x77, 0x01}, 0x100a },
 };
 
-static int tascam_write_regs(struct tascam_card *tascam, const u16 *regs, size_t count)
+/* Vendor registers the rate sequence writes that don't depend on the rate */
+static const u16 rate_fixed_regs_pre[] = { 0x0d04, 0x0e00, 0x0f00 };
+static const u16 rate_fixed_regs_post[] = { 0x110b };
+
+#define TASCAM_RATE_CTRL_MAX (4 + ARRAY_SIZE(rate_fixed_regs_pre) + \
+			      ARRAY_SIZE(rate_fixed_regs_post) + 1)
+
+/**
+ * struct tascam_ctrl_batch - control transfers submitted together
+ * @setup: setup packets, one per transfer
+ * @payload: the sample rate, shared by both SET_CUR requests
+ * @urbs: the control URBs
+ * @count: number of transfers in the batch
+ * @anchor: anchor the batch is waited on with
+ * @status: first error reported by a completion, or 0
+ */
+struct tascam_ctrl_batch {
+	struct usb_ctrlrequest setup[TASCAM_RATE_CTRL_MAX];
+	u8 payload[3];
+	struct urb *urbs[TASCAM_RATE_CTRL_MAX];
+	unsigned int count;
+	struct usb_anchor anchor;
+	atomic_t status;
+};
+
+static void tascam_ctrl_batch_complete(struct urb *urb)
+{
+	struct tascam_ctrl_batch *batch = urb->context;
+
+	if (urb->status)
+		atomic_cmpxchg(&batch->status, 0, urb->status);
+}
+
+static void tascam_ctrl_batch_add(struct tascam_ctrl_batch *batch, u8 request_type, u8 request,
+				  u16 value, u16 index, u16 length)
+{
+	struct usb_ctrlrequest *setup = &batch->setup[batch->count++];
+
+	setup->bRequestType = request_type;
+	setup->bRequest = request;
+	setup->wValue = cpu_to_le16(value);
+	setup->wIndex = cpu_to_le16(index);
+	setup->wLength = cpu_to_le16(length);
+}
+
+/*
+ * Submit every transfer of @batch at once and wait for the lot. Control
+ * URBs on one endpoint complete in submission order, so the device sees
+ * the same sequence as with back-to-back usb_control_msg() calls, without
+ * a round trip through the scheduler between each of them.
+ */
+static int tascam_ctrl_batch_run(struct tascam_card *tascam, struct tascam_ctrl_batch *batch)
 {
-	int i, err = 0;
 	struct usb_device *dev = tascam->dev;
+	unsigned int i;
+	int err = 0;
 
-	for (i = 0; i < count; i++) {
-		err = usb_control_msg(dev, usb_sndctrlpipe(dev, 0),
-							  VENDOR_REQ_REGISTER_WRITE, RT_H2D_VENDOR_DEV,
-						regs[i], REG_VAL_ENABLE, NULL, 0, USB_CTRL_TIMEOUT_MS);
-		if (err < 0)
-			return err;
+	init_usb_anchor(&batch->anchor);
+	atomic_set(&batch->status, 0);
+
+	for (i = 0; i < batch->count; i++) {
+		batch->urbs[i] = usb_alloc_urb(0, GFP_KERNEL);
+		if (!batch->urbs[i]) {
+			err = -ENOMEM;
+			goto free;
+		}
+		usb_fill_control_urb(batch->urbs[i], dev, usb_sndctrlpipe(dev, 0),
+				     (u8 *)&batch->setup[i],
+				     le16_to_cpu(batch->setup[i].wLength) ? batch->payload : NULL,
+				     le16_to_cpu(batch->setup[i].wLength),
+				     tascam_ctrl_batch_complete, batch);
 	}
-	return 0;
+
+	for (i = 0; i < batch->count; i++) {
+		usb_anchor_urb(batch->urbs[i], &batch->anchor);
+		err = usb_submit_urb(batch->urbs[i], GFP_KERNEL);
+		if (err < 0) {
+			usb_unanchor_urb(batch->urbs[i]);
+			break;
+		}
+	}
+
+	if (!usb_wait_anchor_empty_timeout(&batch->anchor, USB_CTRL_TIMEOUT_MS)) {
+		usb_kill_anchored_urbs(&batch->anchor);
+		if (!err)
+			err = -ETIMEDOUT;
+	}
+	if (!err)
+		err = atomic_read(&batch->status);
+
+free:
+	for (i = 0; i < batch->count; i++)
+		usb_free_urb(batch->urbs[i]);
+	return err;
 }
 
 /**
@@ -37,16 +118,19 @@ static int tascam_write_regs(struct tascam_card *tascam, const u16 *regs, size_t
  * @rate: the target sample rate (e.g., 44100, 96000)
  *
  * This function sends a sequence of vendor-specific and UAC control messages
- * to configure the device hardware for the specified sample rate.
+ * to configure the device hardware for the specified sample rate. The
+ * vendor registers that don't depend on the rate are only written when
+ * the device state is unknown, i.e. at probe and after resume, and the
+ * whole sequence goes out as one batch of asynchronous control URBs.
  *
  * Return: 0 on success, or a negative error code on failure.
  */
 int us144mkii_configure_device_for_rate(struct tascam_card *tascam, int rate)
 {
-	struct usb_device *dev = tascam->dev;
-	int i, err;
+	struct tascam_ctrl_batch *batch;
 	const struct rate_config *cfg = NULL;
-	u8 *payload;
+	bool fixed = !tascam->rate_regs_cached;
+	int i, err;
 
 	for (i = 0; i < ARRAY_SIZE(rate_map); i++) {
 		if (rate_map[i].rate == rate) {
@@ -57,42 +141,175 @@ int us144mkii_configure_device_for_rate(struct tascam_card *tascam, int rate)
 	if (!cfg)
 		return -EINVAL;
 
-	payload = kmemdup(cfg->data, 3, GFP_KERNEL);
-	if (!payload)
+	batch = kzalloc(sizeof(*batch), GFP_KERNEL);
+	if (!batch)
 		return -ENOMEM;
+	memcpy(batch->payload, cfg->data, sizeof(batch->payload));
 
-	err = usb_control_msg(dev, usb_sndctrlpipe(dev, 0), VENDOR_REQ_MODE_CONTROL,
-						  RT_H2D_VENDOR_DEV, MODE_VAL_CONFIG, 0x0000, NULL, 0, USB_CTRL_TIMEOUT_MS);
-	if (err < 0)
-		goto out;
+	tascam_ctrl_batch_add(batch, RT_H2D_VENDOR_DEV, VENDOR_REQ_MODE_CONTROL,
+			      MODE_VAL_CONFIG, 0x0000, 0);
+	tascam_ctrl_batch_add(batch, RT_H2D_CLASS_EP, UAC_SET_CUR,
+			      UAC_SAMPLING_FREQ_CONTROL, EP_AUDIO_IN, sizeof(batch->payload));
+	tascam_ctrl_batch_add(batch, RT_H2D_CLASS_EP, UAC_SET_CUR,
+			      UAC_SAMPLING_FREQ_CONTROL, EP_AUDIO_OUT, sizeof(batch->payload));
+	for (i = 0; fixed && i < ARRAY_SIZE(rate_fixed_regs_pre); i++)
+		tascam_ctrl_batch_add(batch, RT_H2D_VENDOR_DEV, VENDOR_REQ_REGISTER_WRITE,
+				      rate_fixed_regs_pre[i], REG_VAL_ENABLE, 0);
+	tascam_ctrl_batch_add(batch, RT_H2D_VENDOR_DEV, VENDOR_REQ_REGISTER_WRITE,
+			      cfg->reg, REG_VAL_ENABLE, 0);
+	for (i = 0; fixed && i < ARRAY_SIZE(rate_fixed_regs_post); i++)
+		tascam_ctrl_batch_add(batch, RT_H2D_VENDOR_DEV, VENDOR_REQ_REGISTER_WRITE,
+				      rate_fixed_regs_post[i], REG_VAL_ENABLE, 0);
+	tascam_ctrl_batch_add(batch, RT_H2D_VENDOR_DEV, VENDOR_REQ_MODE_CONTROL,
+			      MODE_VAL_STREAM_START, 0x0000, 0);
 
-	err = usb_control_msg(dev, usb_sndctrlpipe(dev, 0), UAC_SET_CUR,
-						  RT_H2D_CLASS_EP, UAC_SAMPLING_FREQ_CONTROL,
-					   EP_AUDIO_IN, payload, 3, USB_CTRL_TIMEOUT_MS);
-	if (err < 0)
-		goto out;
+	err = tascam_ctrl_batch_run(tascam, batch);
+	tascam->rate_regs_cached = !err;
+	kfree(batch);
+	return err;
+}
 
-	err = usb_control_msg(dev, usb_sndctrlpipe(dev, 0), UAC_SET_CUR,
-						  RT_H2D_CLASS_EP, UAC_SAMPLING_FREQ_CONTROL,
-					   EP_AUDIO_OUT, payload, 3, USB_CTRL_TIMEOUT_MS);
-	if (err < 0)
-		goto out;
+/**
+ * tascam_frames_to_timespec() - convert a frame count to a timestamp
+ * @frames: number of frames
+ * @rate: sample rate in Hz
+ * @ts: returns the duration of @frames at @rate
+ */
+void tascam_frames_to_timespec(u64 frames, unsigned int rate, struct timespec64 *ts)
+{
+	u32 rem;
+
+	ts->tv_sec = div_u64_rem(frames, rate, &rem);
+	ts->tv_nsec = div_u64((u64)rem * NSEC_PER_SEC, rate);
+}
+
+/**
+ * tascam_duplex_publish() - publish the offset of a pending linked start
+ * @tascam: the tascam_card instance
+ *
+ * Once both the capture submission and the first playback packet of a
+ * linked start have been timed, their distance becomes the duplex start
+ * offset. Playback starting first, or implausibly late, leaves it at 0.
+ * Caller holds playback_lock.
+ */
+void tascam_duplex_publish(struct tascam_card *tascam)
+{
+	s64 delta;
+
+	if (!tascam->duplex_pending || !tascam->duplex_capture_time ||
+	    !tascam->duplex_playback_time)
+		return;
 
-	{
-		const u16 regs_to_write[] = {
-			0x0d04, 0x0e00, 0x0f00, cfg->reg, 0x110b
-		};
-		err = tascam_write_regs(tascam, regs_to_write, ARRAY_SIZE(regs_to_write));
-		if (err < 0)
-			goto out;
+	tascam->duplex_pending = false;
+	delta = tascam->duplex_playback_time - tascam->duplex_capture_time;
+	if (delta > 0 && delta < TASCAM_DUPLEX_MAX_NS)
+		WRITE_ONCE(tascam->duplex_offset,
+			   div_u64((u64)delta * tascam->current_rate, NSEC_PER_SEC));
+}
+
+/**
+ * tascam_pcm_trigger_linked() - start linked playback and capture together
+ * @substream: the substream the trigger was issued on
+ * @cmd: the trigger command
+ *
+ * When the main playback and capture substreams are linked with
+ * snd_pcm_link(), both are started from the first trigger call: playback
+ * first, then capture right away, and the other substream is marked done
+ * so the core does not trigger it again. If capture fails to start,
+ * playback goes back to the ghost stream before the error is returned.
+ *
+ * The two directions are not scheduled on a common frame: capture runs
+ * over bulk transfers, which have no start frame, and the host controller
+ * picks the microframe the playback queue starts on. The offset between
+ * them is reported instead, measured from the capture submission to the
+ * time the first playback URB's packets went out as given by its
+ * completion, and published as the duplex start offset once that
+ * completion arrives.
+ *
+ * Return: 1 if the start was handled here, 0 if @substream is not part of
+ * a linked duplex start, or a negative error code on failure.
+ */
+int tascam_pcm_trigger_linked(struct snd_pcm_substream *substream, int cmd)
+{
+	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
+	struct snd_pcm_substream *s, *playback = NULL, *capture = NULL;
+	unsigned long flags;
+	u64 now;
+	int err;
+
+	if (cmd != SNDRV_PCM_TRIGGER_START)
+		return 0;
+
+	snd_pcm_group_for_each_entry(s, substream) {
+		if (s->pcm != tascam->pcm || s->number != 0)
+			continue;
+		if (s->stream == SNDRV_PCM_STREAM_PLAYBACK)
+			playback = s;
+		else
+			capture = s;
 	}
+	if (!playback || !capture)
+		return 0;
 
-	err = usb_control_msg(dev, usb_sndctrlpipe(dev, 0), VENDOR_REQ_MODE_CONTROL,
-						  RT_H2D_VENDOR_DEV, MODE_VAL_STREAM_START, 0x0000, NULL, 0, USB_CTRL_TIMEOUT_MS);
+	spin_lock_irqsave(&tascam->playback_lock, flags);
+	WRITE_ONCE(tascam->duplex_offset, 0);
+	tascam->duplex_pending = true;
+	tascam->duplex_capture_time = 0;
+	tascam->duplex_playback_time = 0;
+	spin_unlock_irqrestore(&tascam->playback_lock, flags);
 
-	out:
-	kfree(payload);
-	return err;
+	tascam_playback_start(tascam);
+	now = ktime_get_ns();
+	err = tascam_capture_start(tascam);
+
+	if (err < 0) {
+		/* The core only undoes substreams it started itself */
+		tascam_playback_stop(tascam);
+		spin_lock_irqsave(&tascam->playback_lock, flags);
+		tascam->duplex_pending = false;
+		spin_unlock_irqrestore(&tascam->playback_lock, flags);
+		return err;
+	}
+
+	spin_lock_irqsave(&tascam->playback_lock, flags);
+	tascam->duplex_capture_time = now;
+	tascam_duplex_publish(tascam);
+	spin_unlock_irqrestore(&tascam->playback_lock, flags);
+
+	snd_pcm_trigger_done(playback, substream);
+	snd_pcm_trigger_done(capture, substream);
+	return 1;
+}
+
+/* Caller holds playback_lock */
+static bool tascam_pcm_rate_locked(struct tascam_card *tascam)
+{
+	return atomic_read(&tascam->playback_active) || atomic_read(&tascam->capture_active) ||
+	       atomic_read(&tascam->loopback_active) || atomic_read(&tascam->mix_streams_active);
+}
+
+/**
+ * tascam_pcm_constrain_rate() - pin a new substream to the running rate
+ * @substream: the substream being opened
+ *
+ * All substreams share the device clock. While any of them is running,
+ * a newly opened one is limited to the current rate, so it negotiates
+ * that rate (or gets resampled by the plug layer) instead of failing
+ * hw_params with -EBUSY.
+ */
+void tascam_pcm_constrain_rate(struct snd_pcm_substream *substream)
+{
+	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
+	unsigned long flags;
+	int rate = 0;
+
+	spin_lock_irqsave(&tascam->playback_lock, flags);
+	if (tascam_pcm_rate_locked(tascam))
+		rate = tascam->current_rate;
+	spin_unlock_irqrestore(&tascam->playback_lock, flags);
+
+	if (rate > 0)
+		snd_pcm_hw_constraint_single(substream->runtime, SNDRV_PCM_HW_PARAM_RATE, rate);
 }
 
 /**
@@ -100,8 +317,14 @@ int us144mkii_configure_device_for_rate(struct tascam_card *tascam, int rate)
  * @substream: the ALSA PCM substream
  * @params: the hardware parameters to apply
  *
- * This function allocates pages for the PCM buffer and configures the
- * device hardware for the selected sample rate if it has changed.
+ * This function selects the playback latency profile or the capture URB
+ * geometry, and configures the device hardware for the selected sample rate
+ * if it has changed.
+ *
+ * The first call after probe or resume waits for the device bring-up.
+ * A rate change only has to wait for the ghost stream, which is drained,
+ * and restarted at the new rate once the device is reconfigured; a player
+ * moving between 44.1 and 48 kHz tracks keeps its clocked URB queue.
  *
  * Return: 0 on success, or a negative error code on failure.
  */
@@ -110,19 +333,30 @@ int tascam_pcm_hw_params(struct snd_pcm_substream *substream, struct snd_pcm_hw_
 	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
 	unsigned int rate = params_rate(params);
 	unsigned long flags;
+	bool ghost;
 	int err;
 
-	spin_lock_irqsave(&tascam->lock, flags);
+	err = tascam_wait_init(tascam);
+	if (err < 0)
+		return err;
+
+	/* The URB geometry follows the first subdevice only */
+	if (substream->stream == SNDRV_PCM_STREAM_PLAYBACK && substream->number == 0)
+		tascam_playback_select_profile(tascam, params);
+
+	spin_lock_irqsave(&tascam->playback_lock, flags);
 	if (tascam->current_rate == rate) {
-		spin_unlock_irqrestore(&tascam->lock, flags);
-		return 0;
+		spin_unlock_irqrestore(&tascam->playback_lock, flags);
+		goto out;
 	}
 
-	if (atomic_read(&tascam->playback_active) || atomic_read(&tascam->capture_active)) {
-		spin_unlock_irqrestore(&tascam->lock, flags);
+	if (tascam_pcm_rate_locked(tascam)) {
+		spin_unlock_irqrestore(&tascam->playback_lock, flags);
 		return -EBUSY;
 	}
-	spin_unlock_irqrestore(&tascam->lock, flags);
+	ghost = tascam->running_ghost_playback;
+	tascam->running_ghost_playback = false;
+	spin_unlock_irqrestore(&tascam->playback_lock, flags);
 
 	usb_kill_anchored_urbs(&tascam->playback_anchor);
 	usb_kill_anchored_urbs(&tascam->feedback_anchor);
@@ -131,16 +365,25 @@ int tascam_pcm_hw_params(struct snd_pcm_substream *substream, struct snd_pcm_hw_
 
 	err = us144mkii_configure_device_for_rate(tascam, rate);
 	if (err < 0) {
-		spin_lock_irqsave(&tascam->lock, flags);
+		spin_lock_irqsave(&tascam->playback_lock, flags);
 		tascam->current_rate = 0;
-		spin_unlock_irqrestore(&tascam->lock, flags);
+		spin_unlock_irqrestore(&tascam->playback_lock, flags);
 		return err;
 	}
 
-	spin_lock_irqsave(&tascam->lock, flags);
+	spin_lock_irqsave(&tascam->playback_lock, flags);
 	tascam->current_rate = rate;
-	spin_unlock_irqrestore(&tascam->lock, flags);
+	spin_unlock_irqrestore(&tascam->playback_lock, flags);
+
+	/* Bring the clock back for whoever was holding it, at the new rate */
+	if (ghost || atomic_read(&tascam->stream_refs) > 0)
+		tascam_playback_start_ghost(tascam);
 
+out:
+	/* Only once the rate is known to be accepted */
+	if (substream->stream == SNDRV_PCM_STREAM_CAPTURE &&
+	    substream->number != TASCAM_LOOPBACK_SUBDEVICE)
+		tascam_capture_select_geometry(tascam, params);
 	return 0;
 }
 
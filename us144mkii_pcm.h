@@ -10,12 +10,47 @@ extern const struct snd_pcm_hardware tascam_playback_hw;
 extern const struct snd_pcm_hardware tascam_capture_hw;
 extern const struct snd_pcm_ops tascam_playback_ops;
 extern const struct snd_pcm_ops tascam_capture_ops;
+extern const struct snd_pcm_hardware tascam_loopback_hw;
+extern const struct snd_pcm_ops tascam_loopback_ops;
+extern const struct snd_pcm_hardware tascam_mix_hw;
+extern const struct snd_pcm_ops tascam_mix_ops;
 
 void playback_urb_complete(struct urb *urb);
 void feedback_urb_complete(struct urb *urb);
 void capture_urb_complete(struct urb *urb);
+void tascam_select_capture_decoder(struct tascam_card *tascam);
+void tascam_frames_to_timespec(u64 frames, unsigned int rate, struct timespec64 *ts);
 int us144mkii_configure_device_for_rate(struct tascam_card *tascam, int rate);
 void tascam_stop_pcm_work_handler(struct work_struct *work);
+void tascam_playback_select_profile(struct tascam_card *tascam, struct snd_pcm_hw_params *params);
+int tascam_playback_proc_init(struct tascam_card *tascam);
+void tascam_capture_select_geometry(struct tascam_card *tascam, struct snd_pcm_hw_params *params);
+u32 tascam_measured_rate_mhz(struct tascam_card *tascam);
+void tascam_mix_playback(struct tascam_card *tascam, u8 *dst, unsigned int frames);
+void tascam_loopback_copy(struct tascam_card *tascam, const u8 *src, unsigned int frames);
+void tascam_playback_start(struct tascam_card *tascam);
+void tascam_playback_stop(struct tascam_card *tascam);
+void tascam_duplex_publish(struct tascam_card *tascam);
+int tascam_capture_start(struct tascam_card *tascam);
+int tascam_pcm_trigger_linked(struct snd_pcm_substream *substream, int cmd);
+void tascam_playback_start_ghost(struct tascam_card *tascam);
+void tascam_pcm_constrain_rate(struct snd_pcm_substream *substream);
 int tascam_pcm_hw_params(struct snd_pcm_substream *substream, struct snd_pcm_hw_params *params);
 
+/* Add a 24-bit sample to an S24_3LE one in place, saturating at full scale */
+static inline void tascam_mix_s24(u8 *dst, s32 v)
+{
+	v += (s32)((dst[0] << 8) | (dst[1] << 16) | ((u32)dst[2] << 24)) >> 8;
+	v = clamp(v, -0x800000, 0x7fffff);
+	dst[0] = v;
+	dst[1] = v >> 8;
+	dst[2] = v >> 16;
+}
+
+#if IS_ENABLED(CONFIG_KUNIT)
+/* Pure helpers, exported for the KUnit suite in us144mkii_test.c */
+bool tascam_pll_update(struct tascam_pll *pll, u32 nominal_q16, u32 sample_q16);
+void tascam_decode_capture_chunk(const u8 *src, u32 *dst, int frames);
+#endif
+
 #endif /* __US144MKII_PCM_H */
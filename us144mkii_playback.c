@@ -1,18 +1,25 @@
 // SPDX-License-Identifier: GPL-2.0-only
 // Copyright (c) 2025 Šerif Rami <ramiserifpersia@gmail.com>
 
+#include <linux/gcd.h>
+#include <linux/unaligned.h>
+#include <kunit/visibility.h>
 #include "us144mkii_pcm.h"
+#include "us144mkii_trace.h"
 
 const struct snd_pcm_hardware tascam_playback_hw = {
 	.info = (SNDRV_PCM_INFO_MMAP | SNDRV_PCM_INFO_INTERLEAVED |
 	SNDRV_PCM_INFO_BLOCK_TRANSFER | SNDRV_PCM_INFO_MMAP_VALID |
-	SNDRV_PCM_INFO_PAUSE | SNDRV_PCM_INFO_RESUME),
-	.formats = SNDRV_PCM_FMTBIT_S24_3LE,
+	SNDRV_PCM_INFO_PAUSE | SNDRV_PCM_INFO_RESUME |
+	SNDRV_PCM_INFO_NO_PERIOD_WAKEUP | SNDRV_PCM_INFO_HAS_LINK_ATIME |
+	SNDRV_PCM_INFO_HAS_LINK_ESTIMATED_ATIME),
+	.formats = (SNDRV_PCM_FMTBIT_S24_3LE | SNDRV_PCM_FMTBIT_S32_LE |
+	SNDRV_PCM_FMTBIT_S16_LE),
 	.rates = (SNDRV_PCM_RATE_44100 | SNDRV_PCM_RATE_48000 |
 	SNDRV_PCM_RATE_88200 | SNDRV_PCM_RATE_96000),
 	.rate_min = 44100,
 	.rate_max = 96000,
-	.channels_min = 4,
+	.channels_min = 2,
 	.channels_max = 4,
 	.buffer_bytes_max = 1024 * 1024,
 	.period_bytes_min = 576,
@@ -21,74 +28,541 @@ const struct snd_pcm_hardware tascam_playback_hw = {
 	.periods_max = 1024,
 };
 
+struct tascam_latency_geometry {
+	unsigned int urbs;
+	unsigned int packets;
+};
+
+static const struct tascam_latency_geometry latency_geometry[TASCAM_LATENCY_PROFILE_COUNT] = {
+	[TASCAM_LATENCY_ULTRA_LOW] = { 2, 1 },
+	[TASCAM_LATENCY_LOW] = { 2, 4 },
+	[TASCAM_LATENCY_NORMAL] = { 4, 8 },
+	[TASCAM_LATENCY_HIGH] = { 4, 16 },
+	[TASCAM_LATENCY_BULK] = { 8, 32 },
+};
+
+/**
+ * tascam_playback_select_profile() - choose the playback URB geometry
+ * @tascam: the tascam_card instance
+ * @params: the hardware parameters of the playback stream
+ *
+ * Uses the profile forced by the latency_profile module parameter, or in
+ * auto mode the deepest profile whose queued frames fit inside one period.
+ * The geometry takes effect the next time the URB descriptors are prepared.
+ */
+void tascam_playback_select_profile(struct tascam_card *tascam, struct snd_pcm_hw_params *params)
+{
+	unsigned int frames_per_packet = params_rate(params) / 8000;
+	snd_pcm_uframes_t period = params_period_size(params);
+	snd_pcm_uframes_t buffer = params_buffer_size(params);
+	int p;
+
+	if (tascam->latency_profile != TASCAM_LATENCY_AUTO) {
+		p = tascam->latency_profile;
+		/*
+		 * In zero-copy mode queued URBs still reference the ring, so the
+		 * queue must stay shorter than the buffer the application refills.
+		 */
+		while (tascam->zero_copy && p > TASCAM_LATENCY_ULTRA_LOW &&
+		       latency_geometry[p].urbs * latency_geometry[p].packets *
+		       (frames_per_packet + 1) >= buffer)
+			p--;
+		tascam->playback_profile = p;
+		return;
+	}
+
+	for (p = TASCAM_LATENCY_PROFILE_COUNT - 1; p > TASCAM_LATENCY_ULTRA_LOW; p--) {
+		const struct tascam_latency_geometry *g = &latency_geometry[p];
+
+		if (g->urbs * g->packets * frames_per_packet <= period)
+			break;
+	}
+	tascam->playback_profile = p;
+}
+
 static int submit_urbs(struct tascam_card *tascam, struct urb **urbs, int count, struct usb_anchor *anchor)
 {
-	int i;
+	int i, err;
 	for (i = 0; i < count; i++) {
 		usb_anchor_urb(urbs[i], anchor);
-		if (usb_submit_urb(urbs[i], GFP_ATOMIC) < 0) {
+		err = usb_submit_urb(urbs[i], GFP_ATOMIC);
+		if (err < 0) {
+			trace_tascam_urb_submit_failed(urbs[i], err);
 			usb_unanchor_urb(urbs[i]);
 			return -EIO;
 		}
+		trace_tascam_urb_submit(urbs[i], urbs[i]->transfer_buffer_length, 0);
 		atomic_inc(&tascam->active_urbs);
 	}
 	return 0;
 }
 
-static void prepare_urb_descriptors(struct tascam_card *tascam)
+static int tascam_playback_urb_index(struct tascam_card *tascam, struct urb *urb)
+{
+	int i;
+
+	for (i = 0; i < MAX_PLAYBACK_URBS; i++) {
+		if (tascam->playback_urbs[i] == urb)
+			return i;
+	}
+	WARN_ON_ONCE(1);
+	return -1;
+}
+
+/*
+ * Point playback URB @idx back at its own buffer, and wake a sync_stop
+ * waiting for a zero-copy queue to let go of the ALSA ring.
+ */
+static void tascam_playback_release_ring(struct tascam_card *tascam, struct urb *urb,
+					 unsigned int idx)
+{
+	if (urb->transfer_buffer == tascam->playback_urb_buf[idx])
+		return;
+	urb->transfer_buffer = tascam->playback_urb_buf[idx];
+	urb->transfer_dma = tascam->playback_urb_dma[idx];
+	if (wq_has_sleeper(&tascam->playback_ring_wait))
+		wake_up(&tascam->playback_ring_wait);
+}
+
+static bool tascam_playback_ring_released(struct tascam_card *tascam)
+{
+	unsigned int i;
+
+	for (i = 0; i < MAX_PLAYBACK_URBS; i++) {
+		if (READ_ONCE(tascam->playback_urbs[i]->transfer_buffer) != tascam->playback_urb_buf[i])
+			return false;
+	}
+	return true;
+}
+
+static const struct tascam_latency_geometry ghost_geometry = {
+	GHOST_PLAYBACK_URBS, GHOST_URB_PACKETS
+};
+
+/*
+ * Build the URB queue for the selected latency profile, or with @idle for
+ * a ghost stream nobody listens to. The idle queue is zeroed over the whole
+ * allocation once, so any packet sizes the feedback asks for later still
+ * carry silence without the buffers ever being touched again.
+ */
+static void prepare_urb_descriptors(struct tascam_card *tascam, bool idle)
 {
 	int i, u;
 	size_t nominal_bytes = (tascam->current_rate / 8000) * PLAYBACK_FRAME_SIZE;
+	const struct tascam_latency_geometry *g = idle ? &ghost_geometry :
+						     &latency_geometry[tascam->playback_profile];
+	unsigned int fb_packets = idle ? GHOST_FEEDBACK_URB_PACKETS : FEEDBACK_URB_PACKETS;
+
+	tascam->num_playback_urbs = g->urbs;
+	tascam->playback_urb_packets = g->packets;
+	tascam->playback_urb_profile = idle ? TASCAM_LATENCY_AUTO : tascam->playback_profile;
+	tascam->ghost_idle = idle;
 
 	for (i = 0; i < NUM_FEEDBACK_URBS; i++) {
 		struct urb *f_urb = tascam->feedback_urbs[i];
-		f_urb->number_of_packets = FEEDBACK_URB_PACKETS;
-		f_urb->transfer_buffer_length = FEEDBACK_URB_PACKETS * FEEDBACK_PACKET_SIZE;
-		for (u = 0; u < FEEDBACK_URB_PACKETS; u++) {
+		f_urb->number_of_packets = fb_packets;
+		f_urb->transfer_buffer_length = fb_packets * FEEDBACK_PACKET_SIZE;
+		for (u = 0; u < fb_packets; u++) {
 			f_urb->iso_frame_desc[u].offset = u * FEEDBACK_PACKET_SIZE;
 			f_urb->iso_frame_desc[u].length = FEEDBACK_PACKET_SIZE;
 		}
 	}
 
-	for (u = 0; u < NUM_PLAYBACK_URBS; u++) {
+	for (u = 0; u < tascam->num_playback_urbs; u++) {
 		struct urb *urb = tascam->playback_urbs[u];
-		urb->number_of_packets = PLAYBACK_URB_PACKETS;
-		for (i = 0; i < PLAYBACK_URB_PACKETS; i++) {
+		urb->number_of_packets = tascam->playback_urb_packets;
+		for (i = 0; i < tascam->playback_urb_packets; i++) {
 			urb->iso_frame_desc[i].offset = i * nominal_bytes;
 			urb->iso_frame_desc[i].length = nominal_bytes;
 		}
-		urb->transfer_buffer_length = PLAYBACK_URB_PACKETS * nominal_bytes;
-		memset(urb->transfer_buffer, 0, urb->transfer_buffer_length);
+		urb->transfer_buffer = tascam->playback_urb_buf[u];
+		urb->transfer_dma = tascam->playback_urb_dma[u];
+		urb->transfer_buffer_length = tascam->playback_urb_packets * nominal_bytes;
+		urb->transfer_flags |= URB_ISO_ASAP;
+		memset(urb->transfer_buffer, 0, idle ? tascam->playback_urb_alloc_size :
+			urb->transfer_buffer_length);
 	}
+	memset(tascam->playback_urb_frames, 0, sizeof(tascam->playback_urb_frames));
 }
 
 /**
- * us144mkii_maybe_start_stream() - Start implicit playback for capture/MIDI
+ * tascam_playback_reset_pll() - restart the playback PLL at the nominal rate
  * @tascam: the tascam_card instance
  *
- * Increments reference count and starts the ghost playback stream if no
- * real playback is active.
+ * Besides resetting the Q16 accumulator, this builds the nominal
+ * frames-per-packet pattern for the current rate. One cycle is
+ * 8000 / gcd(rate, 8000) packets long: 80 at 44.1 kHz, 40 at 88.2 kHz and a
+ * single entry at 48 and 96 kHz. Must be called with playback_lock held.
  */
-void us144mkii_maybe_start_stream(struct tascam_card *tascam)
+static void tascam_playback_reset_pll(struct tascam_card *tascam)
 {
-	unsigned long flags;
+	unsigned int rate = tascam->current_rate;
+	unsigned int len, acc = 0, i;
 
-	atomic_inc(&tascam->stream_refs);
+	tascam->phase_accum = 0;
+	tascam->freq_q16 = div_u64(((u64)rate << 16), 8000);
+	tascam->playback_nominal_q16 = tascam->freq_q16;
+	tascam->pll.rate = (s64)tascam->freq_q16 << 16;
+	tascam->pll.drift = 0;
+	tascam->pll.updates = 0;
+	tascam->playback_residual = 0;
+	tascam->playback_schedule_idx = 0;
+	tascam->playback_schedule_len = 0;
 
-	spin_lock_irqsave(&tascam->lock, flags);
-	if (!atomic_read(&tascam->playback_active) && !tascam->running_ghost_playback) {
-		tascam->running_ghost_playback = true;
-		tascam->phase_accum = 0;
-		tascam->freq_q16 = div_u64(((u64)tascam->current_rate << 16), 8000);
-		tascam->feedback_urb_skip_count = 4;
-		tascam->feedback_synced = false;
+	if (!rate)
+		return;
 
-		prepare_urb_descriptors(tascam);
+	len = 8000 / gcd(rate, 8000);
+	if (len > PLAYBACK_SCHEDULE_MAX_LEN)
+		return;
 
-		submit_urbs(tascam, tascam->feedback_urbs, NUM_FEEDBACK_URBS, &tascam->feedback_anchor);
-		submit_urbs(tascam, tascam->playback_urbs, NUM_PLAYBACK_URBS, &tascam->playback_anchor);
+	for (i = 0; i < len; i++) {
+		acc += rate;
+		tascam->playback_schedule[i] = acc / 8000;
+		acc %= 8000;
 	}
-	spin_unlock_irqrestore(&tascam->lock, flags);
+	tascam->playback_schedule_len = len;
+}
+
+/**
+ * tascam_playback_size_packets() - compute the iso packet sizes of a URB
+ * @tascam: the tascam_card instance
+ * @urb: the playback URB to size
+ *
+ * With the packet schedule enabled, the nominal pattern for the rate comes
+ * from the precomputed table and only the deviation reported by the
+ * feedback endpoint is integrated. Otherwise every packet is derived from
+ * the full Q16 phase accumulator. Must be called with playback_lock held.
+ *
+ * Return: the total number of bytes in the URB.
+ */
+static size_t tascam_playback_size_packets(struct tascam_card *tascam, struct urb *urb)
+{
+	s32 delta = (s32)(tascam->freq_q16 - tascam->playback_nominal_q16);
+	size_t total_bytes = 0;
+	unsigned int frames, i;
+
+	if (tascam->packet_schedule && tascam->playback_schedule_len) {
+		for (i = 0; i < urb->number_of_packets; i++) {
+			frames = tascam->playback_schedule[tascam->playback_schedule_idx];
+			if (++tascam->playback_schedule_idx == tascam->playback_schedule_len)
+				tascam->playback_schedule_idx = 0;
+
+			if (delta) {
+				tascam->playback_residual += delta;
+				if (tascam->playback_residual >= 0x10000) {
+					tascam->playback_residual -= 0x10000;
+					frames++;
+				} else if (tascam->playback_residual <= -0x10000) {
+					tascam->playback_residual += 0x10000;
+					frames--;
+				}
+			}
+
+			if (frames > MAX_FRAMES_PER_PACKET) {
+				frames = MAX_FRAMES_PER_PACKET;
+				tascam_stats_clamp(tascam);
+			}
+			urb->iso_frame_desc[i].offset = total_bytes;
+			urb->iso_frame_desc[i].length = frames * PLAYBACK_FRAME_SIZE;
+			total_bytes += frames * PLAYBACK_FRAME_SIZE;
+		}
+		return total_bytes;
+	}
+
+	for (i = 0; i < urb->number_of_packets; i++) {
+		tascam->phase_accum += tascam->freq_q16;
+		frames = tascam->phase_accum >> 16;
+		tascam->phase_accum &= 0xFFFF;
+		if (frames > MAX_FRAMES_PER_PACKET) {
+			frames = MAX_FRAMES_PER_PACKET;
+			tascam_stats_clamp(tascam);
+		}
+		urb->iso_frame_desc[i].offset = total_bytes;
+		urb->iso_frame_desc[i].length = frames * PLAYBACK_FRAME_SIZE;
+		total_bytes += frames * PLAYBACK_FRAME_SIZE;
+	}
+	return total_bytes;
+}
+
+/**
+ * tascam_pack_frames() - convert ring frames to the device's S24_3LE layout
+ * @runtime: the playback runtime
+ * @dst: the URB buffer to fill
+ * @pos: ring position of the first frame
+ * @frames: number of frames to convert, none of them past the ring end
+ *
+ * S32_LE keeps the top three bytes of each sample and S16_LE is padded
+ * with a zero low byte. Each 4-channel frame is assembled in registers and
+ * stored as three 32-bit words, so the conversion costs no more memory
+ * traffic than the plain copy it replaces. A 2-channel stream drives
+ * outputs 1-2 and leaves outputs 3-4 silent.
+ */
+static void tascam_pack_frames(struct snd_pcm_runtime *runtime, u8 *dst,
+			       snd_pcm_uframes_t pos, unsigned int frames)
+{
+	const u8 *src = runtime->dma_area + frames_to_bytes(runtime, pos);
+	bool stereo = runtime->channels == 2;
+	unsigned int i, stride = frames_to_bytes(runtime, 1);
+	u32 s0, s1, s2 = 0, s3 = 0;
+
+	switch (runtime->format) {
+	case SNDRV_PCM_FORMAT_S32_LE:
+		for (i = 0; i < frames; i++, src += stride, dst += PLAYBACK_FRAME_SIZE) {
+			s0 = get_unaligned_le32(src) >> 8;
+			s1 = get_unaligned_le32(src + 4) >> 8;
+			if (!stereo) {
+				s2 = get_unaligned_le32(src + 8) >> 8;
+				s3 = get_unaligned_le32(src + 12) >> 8;
+			}
+			put_unaligned_le32(s0 | (s1 << 24), dst);
+			put_unaligned_le32((s1 >> 8) | (s2 << 16), dst + 4);
+			put_unaligned_le32((s2 >> 16) | (s3 << 8), dst + 8);
+		}
+		break;
+	case SNDRV_PCM_FORMAT_S16_LE:
+		for (i = 0; i < frames; i++, src += stride, dst += PLAYBACK_FRAME_SIZE) {
+			s0 = get_unaligned_le16(src) << 8;
+			s1 = get_unaligned_le16(src + 2) << 8;
+			if (!stereo) {
+				s2 = get_unaligned_le16(src + 4) << 8;
+				s3 = get_unaligned_le16(src + 6) << 8;
+			}
+			put_unaligned_le32(s0 | (s1 << 24), dst);
+			put_unaligned_le32((s1 >> 8) | (s2 << 16), dst + 4);
+			put_unaligned_le32((s2 >> 16) | (s3 << 8), dst + 8);
+		}
+		break;
+	default:
+		if (!stereo) {
+			memcpy(dst, src, frames * PLAYBACK_FRAME_SIZE);
+			break;
+		}
+		for (i = 0; i < frames; i++, src += stride, dst += PLAYBACK_FRAME_SIZE) {
+			memcpy(dst, src, 6);
+			memset(dst + 6, 0, 6);
+		}
+		break;
+	}
+}
+
+/**
+ * tascam_playback_fill() - fill a URB buffer from the ring
+ * @runtime: the playback runtime
+ * @dst: the URB buffer to fill
+ * @pos: ring position of the first frame
+ * @frames: number of frames to transfer
+ *
+ * Splits the transfer at the end of the ring.
+ */
+static void tascam_playback_fill(struct snd_pcm_runtime *runtime, u8 *dst,
+				 snd_pcm_uframes_t pos, unsigned int frames)
+{
+	unsigned int part = min_t(snd_pcm_uframes_t, frames, runtime->buffer_size - pos);
+
+	tascam_pack_frames(runtime, dst, pos, part);
+	if (part < frames)
+		tascam_pack_frames(runtime, dst + part * PLAYBACK_FRAME_SIZE, 0, frames - part);
+}
+
+/**
+ * tascam_monitor_mix() - add the monitored inputs to an outgoing URB
+ * @tascam: the tascam_card instance
+ * @dst: the URB buffer, already holding the playback frames
+ * @frames: number of frames in @dst
+ *
+ * Input n is mixed into output n with saturation. The ring is kept to at
+ * most two capture URBs behind the capture side, so the monitor latency
+ * stays at roughly one capture URB plus the playback queue; older frames
+ * are skipped and a short ring plays the rest of the URB unmixed. URBs
+ * that point straight into the ALSA buffer in zero-copy mode are not mixed.
+ */
+static void tascam_monitor_mix(struct tascam_card *tascam, u8 *dst, unsigned int frames)
+{
+	struct tascam_monitor *mon = &tascam->monitor;
+	unsigned int head = smp_load_acquire(&mon->head);
+	unsigned int tail = mon->tail;
+	unsigned int i, ch, max_lag = 2 * tascam->capture_urb_frames;
+	int gain[NUM_CHANNELS];
+	const s32 *src;
+
+	if (!READ_ONCE(mon->enabled)) {
+		smp_store_release(&mon->tail, head);
+		return;
+	}
+
+	if (head - tail > max_lag)
+		tail = head - max_lag;
+	frames = min(frames, head - tail);
+	for (ch = 0; ch < NUM_CHANNELS; ch++)
+		gain[ch] = READ_ONCE(mon->gain[ch]);
+
+	for (i = 0; i < frames; i++, tail++) {
+		src = &mon->buf[(tail & (MONITOR_RING_FRAMES - 1)) * NUM_CHANNELS];
+		for (ch = 0; ch < NUM_CHANNELS; ch++, dst += 3)
+			tascam_mix_s24(dst, ((s64)(src[ch] >> 8) * gain[ch]) >> MONITOR_GAIN_SHIFT);
+	}
+	smp_store_release(&mon->tail, tail);
+}
+
+/*
+ * Put @frames ring frames from @pos into @urb: point straight into the
+ * ring when it already has the device layout, otherwise convert them into
+ * the URB's own buffer and add the monitored inputs.
+ */
+static void tascam_playback_load(struct tascam_card *tascam, struct snd_pcm_runtime *runtime,
+				 struct urb *urb, snd_pcm_uframes_t pos, unsigned int frames)
+{
+	if (tascam->zero_copy && runtime->format == SNDRV_PCM_FORMAT_S24_3LE &&
+	    runtime->channels == 4 && pos + frames <= runtime->buffer_size &&
+	    !atomic_read(&tascam->mix_streams_active)) {
+		urb->transfer_buffer = runtime->dma_area + frames_to_bytes(runtime, pos);
+		urb->transfer_dma = runtime->dma_addr + frames_to_bytes(runtime, pos);
+	} else {
+		tascam_playback_fill(runtime, urb->transfer_buffer, pos, frames);
+		tascam_monitor_mix(tascam, urb->transfer_buffer, frames);
+	}
+}
+
+/* Account @frames just loaded into URB @idx. Caller holds playback_lock. */
+static void tascam_playback_advance(struct tascam_card *tascam, struct snd_pcm_runtime *runtime,
+				    unsigned int idx, unsigned int frames)
+{
+	tascam->driver_playback_pos += frames;
+	if (tascam->driver_playback_pos >= runtime->buffer_size)
+		tascam->driver_playback_pos -= runtime->buffer_size;
+
+	write_seqcount_begin(&tascam->playback_seq);
+	tascam->playback_step_base = tascam->playback_frames_consumed;
+	tascam->playback_step_frames = frames;
+	tascam->playback_step_time = ktime_get_ns();
+	tascam->playback_frames_consumed += tascam->playback_step_frames;
+	write_seqcount_end(&tascam->playback_seq);
+	tascam->playback_urb_pos[idx] = tascam->playback_step_base;
+	tascam->playback_urb_frames[idx] = tascam->playback_step_frames;
+}
+
+/*
+ * Fill a queue that is about to be submitted from the ring the client has
+ * already filled, so the first URB on the wire carries the first frames of
+ * the stream instead of a queue's worth of silence. Period wakeups for
+ * these frames come from the next completion. Caller holds playback_lock.
+ */
+static void tascam_playback_preroll(struct tascam_card *tascam)
+{
+	struct snd_pcm_runtime *runtime;
+	unsigned int frames, i;
+	struct urb *urb;
+
+	if (!tascam->playback_substream || !tascam->playback_substream->runtime)
+		return;
+	runtime = tascam->playback_substream->runtime;
+
+	for (i = 0; i < tascam->num_playback_urbs; i++) {
+		urb = tascam->playback_urbs[i];
+		urb->transfer_buffer = tascam->playback_urb_buf[i];
+		urb->transfer_dma = tascam->playback_urb_dma[i];
+		urb->transfer_buffer_length = tascam_playback_size_packets(tascam, urb);
+		frames = urb->transfer_buffer_length / PLAYBACK_FRAME_SIZE;
+
+		tascam_playback_load(tascam, runtime, urb, tascam->driver_playback_pos, frames);
+		if (urb->transfer_buffer == tascam->playback_urb_buf[i])
+			tascam_mix_playback(tascam, urb->transfer_buffer, frames);
+		tascam_playback_advance(tascam, runtime, i, frames);
+	}
+}
+
+/**
+ * tascam_playback_proc_read() - dump playback URB sizing statistics
+ * @entry: the proc entry
+ * @buffer: the buffer to print into
+ */
+static void tascam_playback_proc_read(struct snd_info_entry *entry,
+				      struct snd_info_buffer *buffer)
+{
+	struct tascam_card *tascam = entry->private_data;
+	u64 count, total, max;
+	unsigned long flags;
+
+	spin_lock_irqsave(&tascam->playback_lock, flags);
+	count = tascam->pb_sizing_count;
+	total = tascam->pb_sizing_ns;
+	max = tascam->pb_sizing_max_ns;
+	spin_unlock_irqrestore(&tascam->playback_lock, flags);
+
+	snd_iprintf(buffer, "packet schedule: %s\n",
+		    tascam->packet_schedule && tascam->playback_schedule_len ? "table" : "q16");
+	snd_iprintf(buffer, "schedule length: %u\n", tascam->playback_schedule_len);
+	snd_iprintf(buffer, "urbs sized: %llu\n", count);
+	snd_iprintf(buffer, "average ns: %llu\n", count ? div64_u64(total, count) : 0);
+	snd_iprintf(buffer, "max ns: %llu\n", max);
+}
+
+/**
+ * tascam_playback_proc_init() - register the playback timing proc file
+ * @tascam: the tascam_card instance
+ *
+ * Return: 0 on success, or a negative error code on failure.
+ */
+int tascam_playback_proc_init(struct tascam_card *tascam)
+{
+	return snd_card_ro_proc_new(tascam->card, "playback_timing", tascam,
+				    tascam_playback_proc_read);
+}
+
+/*
+ * Nothing writes into an idle ghost queue: no playback client to take it
+ * over, no mix stream and no monitoring.
+ */
+static bool tascam_ghost_can_idle(struct tascam_card *tascam)
+{
+	return !tascam->playback_substream && !atomic_read(&tascam->mix_streams_active) &&
+	       !READ_ONCE(tascam->monitor.enabled);
+}
+
+/* Caller holds playback_lock */
+static void __tascam_playback_start_ghost(struct tascam_card *tascam)
+{
+	tascam->running_ghost_playback = true;
+	tascam_playback_reset_pll(tascam);
+	tascam->feedback_synced = false;
+
+	prepare_urb_descriptors(tascam, tascam_ghost_can_idle(tascam));
+	trace_tascam_stream_mode(false, true, atomic_read(&tascam->stream_refs));
+
+	submit_urbs(tascam, tascam->feedback_urbs, NUM_FEEDBACK_URBS, &tascam->feedback_anchor);
+	submit_urbs(tascam, tascam->playback_urbs, tascam->num_playback_urbs, &tascam->playback_anchor);
+}
+
+/**
+ * tascam_playback_start_ghost() - start the ghost playback stream
+ * @tascam: the tascam_card instance
+ *
+ * Starts sending silence to keep the device clocked, unless real or ghost
+ * playback is already running. When only capture or MIDI need the clock,
+ * the stream runs on the idle geometry.
+ */
+void tascam_playback_start_ghost(struct tascam_card *tascam)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&tascam->playback_lock, flags);
+	if (!atomic_read(&tascam->playback_active) && !tascam->running_ghost_playback)
+		__tascam_playback_start_ghost(tascam);
+	spin_unlock_irqrestore(&tascam->playback_lock, flags);
+}
+
+/**
+ * us144mkii_maybe_start_stream() - Start implicit playback for capture/MIDI
+ * @tascam: the tascam_card instance
+ *
+ * Increments reference count and starts the ghost playback stream if no
+ * real playback is active.
+ */
+void us144mkii_maybe_start_stream(struct tascam_card *tascam)
+{
+	atomic_inc(&tascam->stream_refs);
+	tascam_playback_start_ghost(tascam);
 }
 
 /**
@@ -96,7 +570,8 @@ void us144mkii_maybe_start_stream(struct tascam_card *tascam)
  * @tascam: the tascam_card instance
  *
  * Decrements reference count and stops the ghost playback stream if it
- * reaches zero and no real playback is active.
+ * reaches zero and no playback substream is open; an open one keeps the
+ * ghost stream for its next start.
  */
 void us144mkii_maybe_stop_stream(struct tascam_card *tascam)
 {
@@ -106,21 +581,24 @@ void us144mkii_maybe_stop_stream(struct tascam_card *tascam)
 	if (atomic_dec_return(&tascam->stream_refs) > 0)
 		return;
 
-	spin_lock_irqsave(&tascam->lock, flags);
-	if (!atomic_read(&tascam->playback_active) && tascam->running_ghost_playback) {
+	spin_lock_irqsave(&tascam->playback_lock, flags);
+	if (!atomic_read(&tascam->playback_active) && tascam->running_ghost_playback &&
+	    !tascam->playback_substream) {
 		tascam->running_ghost_playback = false;
-		for (i = 0; i < NUM_PLAYBACK_URBS; i++)
+		trace_tascam_stream_mode(false, false, 0);
+		for (i = 0; i < MAX_PLAYBACK_URBS; i++)
 			usb_unlink_urb(tascam->playback_urbs[i]);
 		for (i = 0; i < NUM_FEEDBACK_URBS; i++)
 			usb_unlink_urb(tascam->feedback_urbs[i]);
 	}
-	spin_unlock_irqrestore(&tascam->lock, flags);
+	spin_unlock_irqrestore(&tascam->playback_lock, flags);
 }
 
 static int tascam_playback_open(struct snd_pcm_substream *substream)
 {
 	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
 	substream->runtime->hw = tascam_playback_hw;
+	tascam_pcm_constrain_rate(substream);
 	tascam->playback_substream = substream;
 	atomic_set(&tascam->playback_active, 0);
 	return 0;
@@ -129,88 +607,362 @@ static int tascam_playback_open(struct snd_pcm_substream *substream)
 static int tascam_playback_close(struct snd_pcm_substream *substream)
 {
 	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
+	unsigned long flags;
+	bool ghost;
+
+	spin_lock_irqsave(&tascam->playback_lock, flags);
 	atomic_set(&tascam->playback_active, 0);
-	usb_kill_anchored_urbs(&tascam->playback_anchor);
-	usb_kill_anchored_urbs(&tascam->feedback_anchor);
 	tascam->playback_substream = NULL;
+	/*
+	 * Leave the ghost stream to whoever else still needs the clock, on
+	 * the idle geometry unless it already is or mixing needs the data.
+	 */
+	ghost = tascam->running_ghost_playback && atomic_read(&tascam->stream_refs) &&
+		(tascam->ghost_idle || !tascam_ghost_can_idle(tascam));
+	tascam->running_ghost_playback = ghost;
+	spin_unlock_irqrestore(&tascam->playback_lock, flags);
+
+	if (!ghost) {
+		usb_kill_anchored_urbs(&tascam->playback_anchor);
+		usb_kill_anchored_urbs(&tascam->feedback_anchor);
+
+		spin_lock_irqsave(&tascam->playback_lock, flags);
+		if (atomic_read(&tascam->stream_refs) && !tascam->running_ghost_playback)
+			__tascam_playback_start_ghost(tascam);
+		spin_unlock_irqrestore(&tascam->playback_lock, flags);
+	}
 	return 0;
 }
 
+/* Caller holds playback_lock */
+static void tascam_playback_reset_position(struct tascam_card *tascam)
+{
+	tascam->driver_playback_pos = 0;
+	write_seqcount_begin(&tascam->playback_seq);
+	tascam->playback_frames_consumed = 0;
+	tascam->playback_step_base = 0;
+	tascam->playback_step_frames = 0;
+	tascam->playback_link_frames = 0;
+	tascam->playback_link_time = ktime_get_ns();
+	tascam->playback_link_start_pos = 0;
+	tascam->playback_link_start_time = 0;
+	write_seqcount_end(&tascam->playback_seq);
+	tascam->duplex_pending = false;
+	tascam->last_pb_period_pos = 0;
+	/* URBs already in flight carry no frames of the new stream */
+	memset(tascam->playback_urb_frames, 0, sizeof(tascam->playback_urb_frames));
+	tascam->pb_sizing_count = 0;
+	tascam->pb_sizing_ns = 0;
+	tascam->pb_sizing_max_ns = 0;
+}
+
+/*
+ * After an xrun or a plain stop the URBs keep running as the ghost stream.
+ * If they were built for the current geometry, prepare only resets the
+ * ring positions and the next start takes them over as they are, with the
+ * rate estimate still locked. Otherwise the queue is torn down and rebuilt,
+ * and the ghost stream restarted if another user still needs the clock.
+ */
 static int tascam_playback_prepare(struct snd_pcm_substream *substream)
 {
 	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
+	unsigned long flags;
+	int err;
+
+	err = tascam_wait_init(tascam);
+	if (err < 0)
+		return err;
+
+	spin_lock_irqsave(&tascam->playback_lock, flags);
+	if (tascam->running_ghost_playback && !atomic_read(&tascam->playback_active) &&
+	    tascam->playback_urb_profile == tascam->playback_profile &&
+	    !usb_anchor_empty(&tascam->playback_anchor)) {
+		tascam_playback_reset_position(tascam);
+		spin_unlock_irqrestore(&tascam->playback_lock, flags);
+		return 0;
+	}
+	tascam->running_ghost_playback = false;
+	spin_unlock_irqrestore(&tascam->playback_lock, flags);
 
 	usb_kill_anchored_urbs(&tascam->playback_anchor);
 	usb_kill_anchored_urbs(&tascam->feedback_anchor);
 
-	tascam->driver_playback_pos = 0;
-	tascam->playback_frames_consumed = 0;
-	tascam->last_pb_period_pos = 0;
+	spin_lock_irqsave(&tascam->playback_lock, flags);
+	tascam_playback_reset_position(tascam);
 	tascam->feedback_synced = false;
-	tascam->running_ghost_playback = false;
-	tascam->feedback_urb_skip_count = 4;
-	tascam->phase_accum = 0;
-	tascam->freq_q16 = div_u64(((u64)tascam->current_rate << 16), 8000);
+	tascam_playback_reset_pll(tascam);
 
-	prepare_urb_descriptors(tascam);
+	prepare_urb_descriptors(tascam, false);
+	if (atomic_read(&tascam->stream_refs) > 0) {
+		tascam->running_ghost_playback = true;
+		submit_urbs(tascam, tascam->feedback_urbs, NUM_FEEDBACK_URBS, &tascam->feedback_anchor);
+		submit_urbs(tascam, tascam->playback_urbs, tascam->num_playback_urbs, &tascam->playback_anchor);
+	}
+	spin_unlock_irqrestore(&tascam->playback_lock, flags);
 	return 0;
 }
 
+/*
+ * Switch the URB queue over to the PCM stream. Caller holds playback_lock.
+ * A running ghost stream is taken over in place: each URB is refilled
+ * from the ring on its next completion, in whatever geometry the queue was
+ * built with, so the first frames wait behind the silence already queued
+ * but no URB is unlinked.
+ */
+static void __tascam_playback_start(struct tascam_card *tascam)
+{
+	if (atomic_read(&tascam->playback_active))
+		return;
+
+	atomic_set(&tascam->playback_active, 1);
+	write_seqcount_begin(&tascam->playback_seq);
+	tascam->playback_link_time = ktime_get_ns();
+	write_seqcount_end(&tascam->playback_seq);
+	/* If ghost playback is running, just takeover flag */
+	if (tascam->running_ghost_playback) {
+		tascam->running_ghost_playback = false;
+		tascam->ghost_idle = false;
+	} else {
+		tascam_playback_preroll(tascam);
+		submit_urbs(tascam, tascam->feedback_urbs, NUM_FEEDBACK_URBS, &tascam->feedback_anchor);
+		submit_urbs(tascam, tascam->playback_urbs, tascam->num_playback_urbs, &tascam->playback_anchor);
+	}
+	trace_tascam_stream_mode(true, false, atomic_read(&tascam->stream_refs));
+}
+
+/**
+ * tascam_playback_start() - start PCM playback
+ * @tascam: the tascam_card instance
+ */
+void tascam_playback_start(struct tascam_card *tascam)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&tascam->playback_lock, flags);
+	__tascam_playback_start(tascam);
+	spin_unlock_irqrestore(&tascam->playback_lock, flags);
+}
+
+static void __tascam_playback_stop(struct tascam_card *tascam)
+{
+	atomic_set(&tascam->playback_active, 0);
+	/*
+	 * Fall back to ghost playback so that a restart after an xrun finds
+	 * the stream clocked; close stops it unless capture/midi still need it.
+	 */
+	tascam->running_ghost_playback = true;
+	trace_tascam_stream_mode(false, tascam->running_ghost_playback,
+				 atomic_read(&tascam->stream_refs));
+}
+
+/**
+ * tascam_playback_stop() - stop PCM playback, leaving the ghost stream
+ * @tascam: the tascam_card instance
+ */
+void tascam_playback_stop(struct tascam_card *tascam)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&tascam->playback_lock, flags);
+	__tascam_playback_stop(tascam);
+	spin_unlock_irqrestore(&tascam->playback_lock, flags);
+}
+
 static int tascam_playback_trigger(struct snd_pcm_substream *substream, int cmd)
 {
 	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
 	unsigned long flags;
-	int ret = 0;
+	int ret;
 
-	spin_lock_irqsave(&tascam->lock, flags);
+	ret = tascam_pcm_trigger_linked(substream, cmd);
+	if (ret)
+		return ret < 0 ? ret : 0;
+
+	spin_lock_irqsave(&tascam->playback_lock, flags);
 	switch (cmd) {
-		case SNDRV_PCM_TRIGGER_START:
 		case SNDRV_PCM_TRIGGER_RESUME:
-			if (!atomic_read(&tascam->playback_active)) {
-				atomic_set(&tascam->playback_active, 1);
-				/* If ghost playback is running, just takeover flag */
-				if (tascam->running_ghost_playback) {
-					tascam->running_ghost_playback = false;
-				} else {
-					submit_urbs(tascam, tascam->feedback_urbs, NUM_FEEDBACK_URBS, &tascam->feedback_anchor);
-					submit_urbs(tascam, tascam->playback_urbs, NUM_PLAYBACK_URBS, &tascam->playback_anchor);
-				}
+			/* Not reconfigured yet; the client falls back to prepare */
+			if (!completion_done(&tascam->init_done)) {
+				ret = -EAGAIN;
+				break;
 			}
+			fallthrough;
+		case SNDRV_PCM_TRIGGER_START:
+		case SNDRV_PCM_TRIGGER_PAUSE_RELEASE:
+			__tascam_playback_start(tascam);
 			break;
 		case SNDRV_PCM_TRIGGER_STOP:
 		case SNDRV_PCM_TRIGGER_SUSPEND:
 		case SNDRV_PCM_TRIGGER_PAUSE_PUSH:
-			atomic_set(&tascam->playback_active, 0);
-			/* Fall back to ghost playback if capture/midi active */
-			if (atomic_read(&tascam->stream_refs) > 0)
-				tascam->running_ghost_playback = true;
-		break;
+			__tascam_playback_stop(tascam);
+			break;
 		default:
 			ret = -EINVAL;
 			break;
 	}
-	spin_unlock_irqrestore(&tascam->lock, flags);
+	spin_unlock_irqrestore(&tascam->playback_lock, flags);
 	return ret;
 }
 
-static snd_pcm_uframes_t tascam_playback_pointer(struct snd_pcm_substream *substream)
+/*
+ * A stopped stream keeps its URBs going as the ghost stream, and in
+ * zero-copy mode the ones already queued still read the ALSA ring, which
+ * hw_free may release as soon as this returns. Each completion points its
+ * URB back at its own buffer; if the link stops completing them, the queue
+ * is torn down instead and the ghost stream restarted for whoever still
+ * needs the clock.
+ */
+static int tascam_playback_sync_stop(struct snd_pcm_substream *substream)
 {
 	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
 	unsigned long flags;
-	u64 pos;
+	unsigned int i;
+
+	if (wait_event_timeout(tascam->playback_ring_wait, tascam_playback_ring_released(tascam),
+			       msecs_to_jiffies(TASCAM_RING_RELEASE_TIMEOUT_MS)))
+		return 0;
+
+	spin_lock_irqsave(&tascam->playback_lock, flags);
+	tascam->running_ghost_playback = false;
+	spin_unlock_irqrestore(&tascam->playback_lock, flags);
+
+	usb_kill_anchored_urbs(&tascam->playback_anchor);
+	usb_kill_anchored_urbs(&tascam->feedback_anchor);
+
+	spin_lock_irqsave(&tascam->playback_lock, flags);
+	for (i = 0; i < MAX_PLAYBACK_URBS; i++)
+		tascam_playback_release_ring(tascam, tascam->playback_urbs[i], i);
+	if (atomic_read(&tascam->stream_refs) && !atomic_read(&tascam->playback_active) &&
+	    !tascam->running_ghost_playback)
+		__tascam_playback_start_ghost(tascam);
+	spin_unlock_irqrestore(&tascam->playback_lock, flags);
+	return 0;
+}
+
+static snd_pcm_uframes_t tascam_playback_pointer(struct snd_pcm_substream *substream)
+{
+	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	unsigned int seq, step_frames;
+	u64 base, step_time, elapsed, link, link_time, now, played;
+	u32 ptr;
 
 	if (!atomic_read(&tascam->playback_active))
 		return 0;
 
-	spin_lock_irqsave(&tascam->lock, flags);
-	pos = tascam->playback_frames_consumed;
-	spin_unlock_irqrestore(&tascam->lock, flags);
+	do {
+		seq = read_seqcount_begin(&tascam->playback_seq);
+		base = tascam->playback_step_base;
+		step_frames = tascam->playback_step_frames;
+		step_time = tascam->playback_step_time;
+		link = tascam->playback_link_frames;
+		link_time = tascam->playback_link_time;
+	} while (read_seqcount_retry(&tascam->playback_seq, seq));
+
+	now = ktime_get_ns();
+
+	/*
+	 * With zero-copy the host controller reads the ring itself, so a frame
+	 * may only be handed back to the application once its URB completed.
+	 */
+	if (tascam->zero_copy) {
+		base = link;
+		step_frames = 0;
+	}
+
+	/*
+	 * The last URB fill took step_frames out of the ring at once; spread
+	 * them over the time the device needs to play them so that timer-driven
+	 * clients see a smoothly advancing pointer, never ahead of the fill.
+	 */
+	if (step_frames) {
+		elapsed = min_t(u64, now - step_time, NSEC_PER_SEC);
+		base += min_t(u64, div_u64(elapsed * runtime->rate, NSEC_PER_SEC), step_frames);
+	}
 
-	return (snd_pcm_uframes_t)(pos % substream->runtime->buffer_size);
+	/*
+	 * Everything between the pointer and the last completed URB is still
+	 * queued on the bus. The URB after that one is playing right now, so
+	 * count down through it at the nominal rate, but not past its end.
+	 */
+	elapsed = min_t(u64, now - link_time, NSEC_PER_SEC);
+	played = link + min_t(u64, div_u64(elapsed * runtime->rate, NSEC_PER_SEC),
+			      tascam->playback_urb_packets * (runtime->rate / 8000 + 1));
+	runtime->delay = played < base ? base - played : 0;
+
+	div_u64_rem(base, runtime->buffer_size, &ptr);
+	return ptr;
 }
 
 /**
- * playback_urb_complete() - completion handler for playback isochronous URBs
+ * tascam_playback_get_time_info() - report link audio timestamps
+ * @substream: the ALSA PCM substream
+ * @system_ts: returns the system time the audio timestamp corresponds to
+ * @audio_ts: returns the audio timestamp
+ * @audio_tstamp_config: the timestamp type requested by userspace
+ * @audio_tstamp_report: returns the timestamp type and accuracy provided
+ *
+ * LINK reports the ring frames whose URBs the host controller has completed,
+ * paired with the completion time. That time is taken in the completion
+ * handler, after however long the controller and its interrupt took, so it
+ * is answered as LINK_ESTIMATED with no accuracy given. LINK_ESTIMATED
+ * extrapolates at the nominal rate from the time the last completed URB
+ * started going out, its completion time less the URB's duration on the
+ * link.
+ *
+ * Return: always 0.
+ */
+static int tascam_playback_get_time_info(struct snd_pcm_substream *substream,
+					 struct timespec64 *system_ts, struct timespec64 *audio_ts,
+					 struct snd_pcm_audio_tstamp_config *audio_tstamp_config,
+					 struct snd_pcm_audio_tstamp_report *audio_tstamp_report)
+{
+	struct tascam_card *tascam = snd_pcm_substream_chip(substream);
+	struct snd_pcm_runtime *runtime = substream->runtime;
+	u64 frames, link_time, start_pos, start_time, filled, now;
+	unsigned int seq;
+
+	do {
+		seq = read_seqcount_begin(&tascam->playback_seq);
+		frames = tascam->playback_link_frames;
+		link_time = tascam->playback_link_time;
+		start_pos = tascam->playback_link_start_pos;
+		start_time = tascam->playback_link_start_time;
+		filled = tascam->playback_frames_consumed;
+	} while (read_seqcount_retry(&tascam->playback_seq, seq));
+
+	switch (audio_tstamp_config->type_requested) {
+	case SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK:
+		now = ktime_get_ns();
+		snd_pcm_gettime(runtime, system_ts);
+		*system_ts = ns_to_timespec64(timespec64_to_ns(system_ts) - (now - link_time));
+		/* Paired with the completion time, not a controller timestamp */
+		audio_tstamp_report->actual_type = SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK_ESTIMATED;
+		audio_tstamp_report->accuracy_report = 0;
+		break;
+	case SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK_ESTIMATED:
+		now = ktime_get_ns();
+		snd_pcm_gettime(runtime, system_ts);
+		if (start_time && now > start_time)
+			frames = clamp_t(u64, start_pos +
+					 div_u64(min_t(u64, now - start_time, NSEC_PER_SEC) * runtime->rate,
+						 NSEC_PER_SEC),
+					 frames, filled);
+		audio_tstamp_report->actual_type = SNDRV_PCM_AUDIO_TSTAMP_TYPE_LINK_ESTIMATED;
+		audio_tstamp_report->accuracy = TASCAM_FRAME_NS;
+		audio_tstamp_report->accuracy_report = 1;
+		break;
+	default:
+		audio_tstamp_report->actual_type = SNDRV_PCM_AUDIO_TSTAMP_TYPE_DEFAULT;
+		return 0;
+	}
+
+	tascam_frames_to_timespec(frames, runtime->rate, audio_ts);
+	return 0;
+}
+
+/**
+ * __playback_urb_complete() - completion handler for playback isochronous URBs
  * @urb: the completed URB
  *
  * This function runs in interrupt context. It calculates the number of bytes
@@ -218,46 +970,83 @@ static snd_pcm_uframes_t tascam_playback_pointer(struct snd_pcm_substream *subst
  * copies the audio data from the ALSA ring buffer (or zero for ghost stream),
  * and resubmits the URB.
  */
-void playback_urb_complete(struct urb *urb)
+static void __playback_urb_complete(struct urb *urb)
 {
 	struct tascam_card *tascam = urb->context;
 	struct snd_pcm_runtime *runtime;
 	size_t total_bytes = 0;
-	size_t ptr_bytes, part1_bytes;
-	unsigned int frames, i;
+	snd_pcm_uframes_t pos;
+	unsigned int frames;
 	unsigned long flags;
+	u64 t0, hw_frames;
+	int err, idx;
 	bool need_period_elapsed = false;
 
-	if (urb->status || !tascam ||
+	trace_tascam_urb_complete(urb, urb->actual_length, urb->actual_length / PLAYBACK_FRAME_SIZE);
+
+	if (!tascam)
+		return;
+
+	idx = tascam_playback_urb_index(tascam, urb);
+	if (idx < 0 || urb->status ||
 	    (!atomic_read(&tascam->playback_active) &&
 	     !tascam->running_ghost_playback)) {
-		if (tascam) {
-			usb_unanchor_urb(urb);
-			atomic_dec(&tascam->active_urbs);
-		}
+		if (idx >= 0)
+			tascam_playback_release_ring(tascam, urb, idx);
+		usb_unanchor_urb(urb);
+		atomic_dec(&tascam->active_urbs);
 		return;
 	}
 
-	spin_lock_irqsave(&tascam->lock, flags);
+	spin_lock_irqsave(&tascam->playback_lock, flags);
 
-	for (i = 0; i < urb->number_of_packets; i++) {
-		tascam->phase_accum += tascam->freq_q16;
-		frames = min((tascam->phase_accum >> 16), (u32)MAX_FRAMES_PER_PACKET);
-		tascam->phase_accum &= 0xFFFF;
-		urb->iso_frame_desc[i].offset = total_bytes;
-		urb->iso_frame_desc[i].length = frames * PLAYBACK_FRAME_SIZE;
-		total_bytes += frames * PLAYBACK_FRAME_SIZE;
+	/* The ring frames this URB carried have now gone out on the link */
+	if (tascam->playback_urb_frames[idx]) {
+		write_seqcount_begin(&tascam->playback_seq);
+		tascam->playback_link_frames = tascam->playback_urb_pos[idx] +
+					       tascam->playback_urb_frames[idx];
+		tascam->playback_link_time = ktime_get_ns();
+		tascam->playback_link_start_pos = tascam->playback_urb_pos[idx];
+		tascam->playback_link_start_time = tascam->playback_link_time -
+						   urb->number_of_packets * TASCAM_UFRAME_NS;
+		write_seqcount_end(&tascam->playback_seq);
+		tascam->playback_urb_frames[idx] = 0;
+		/* The first frames of the stream are out: time a linked start by them */
+		if (!tascam->playback_urb_pos[idx] && tascam->duplex_pending) {
+			tascam->duplex_playback_time = tascam->playback_link_start_time;
+			tascam_duplex_publish(tascam);
+		}
 	}
+
+	/* Silence and wrap-crossing URBs go through the URB's own buffer */
+	tascam_playback_release_ring(tascam, urb, idx);
+
+	t0 = ktime_get_ns();
+	total_bytes = tascam_playback_size_packets(tascam, urb);
+	t0 = ktime_get_ns() - t0;
+	tascam->pb_sizing_count++;
+	tascam->pb_sizing_ns += t0;
+	if (t0 > tascam->pb_sizing_max_ns)
+		tascam->pb_sizing_max_ns = t0;
 	urb->transfer_buffer_length = total_bytes;
 
 	/* Ghost Playback: Send Silence */
 	if (!atomic_read(&tascam->playback_active)) {
 		if (tascam->running_ghost_playback) {
+			/* A mix or monitor user showed up: rewrite the URBs from now on */
+			if (tascam->ghost_idle && (atomic_read(&tascam->mix_streams_active) ||
+						   READ_ONCE(tascam->monitor.enabled)))
+				tascam->ghost_idle = false;
+			if (tascam->ghost_idle) {
+				spin_unlock_irqrestore(&tascam->playback_lock, flags);
+				goto resubmit;
+			}
 			memset(urb->transfer_buffer, 0, total_bytes);
-			spin_unlock_irqrestore(&tascam->lock, flags);
+			spin_unlock_irqrestore(&tascam->playback_lock, flags);
+			tascam_monitor_mix(tascam, urb->transfer_buffer, total_bytes / PLAYBACK_FRAME_SIZE);
 			goto resubmit;
 		}
-		spin_unlock_irqrestore(&tascam->lock, flags);
+		spin_unlock_irqrestore(&tascam->playback_lock, flags);
 		usb_unanchor_urb(urb);
 		atomic_dec(&tascam->active_urbs);
 		return;
@@ -265,60 +1054,149 @@ void playback_urb_complete(struct urb *urb)
 
 	if (!tascam->playback_substream) {
 		memset(urb->transfer_buffer, 0, total_bytes);
-		spin_unlock_irqrestore(&tascam->lock, flags);
+		spin_unlock_irqrestore(&tascam->playback_lock, flags);
+		tascam_monitor_mix(tascam, urb->transfer_buffer, total_bytes / PLAYBACK_FRAME_SIZE);
 		goto resubmit;
 	}
 
 	runtime = tascam->playback_substream->runtime;
-	ptr_bytes = frames_to_bytes(runtime, tascam->driver_playback_pos);
-	spin_unlock_irqrestore(&tascam->lock, flags);
-
-	/* Copy from ALSA Buffer */
-	if (total_bytes + ptr_bytes > frames_to_bytes(runtime, runtime->buffer_size)) {
-		part1_bytes = frames_to_bytes(runtime, runtime->buffer_size) - ptr_bytes;
-		memcpy(urb->transfer_buffer, runtime->dma_area + ptr_bytes, part1_bytes);
-		memcpy(urb->transfer_buffer + part1_bytes, runtime->dma_area, total_bytes - part1_bytes);
-	} else {
-		memcpy(urb->transfer_buffer, runtime->dma_area + ptr_bytes, total_bytes);
-	}
+	pos = tascam->driver_playback_pos;
+	spin_unlock_irqrestore(&tascam->playback_lock, flags);
 
-	spin_lock_irqsave(&tascam->lock, flags);
-	tascam->driver_playback_pos += bytes_to_frames(runtime, total_bytes);
-	if (tascam->driver_playback_pos >= runtime->buffer_size)
-		tascam->driver_playback_pos -= runtime->buffer_size;
+	frames = total_bytes / PLAYBACK_FRAME_SIZE;
+	tascam_playback_load(tascam, runtime, urb, pos, frames);
 
-	tascam->playback_frames_consumed += bytes_to_frames(runtime, total_bytes);
-	if (div_u64(tascam->playback_frames_consumed, runtime->period_size) > tascam->last_pb_period_pos) {
-		tascam->last_pb_period_pos = div_u64(tascam->playback_frames_consumed, runtime->period_size);
-		need_period_elapsed = true;
+	spin_lock_irqsave(&tascam->playback_lock, flags);
+	tascam_playback_advance(tascam, runtime, idx, frames);
+	/* In zero-copy mode frames only leave the ring once their URB is done */
+	hw_frames = tascam->zero_copy ? tascam->playback_link_frames :
+					tascam->playback_frames_consumed;
+	if (div_u64(hw_frames, runtime->period_size) > tascam->last_pb_period_pos) {
+		tascam->last_pb_period_pos = div_u64(hw_frames, runtime->period_size);
+		need_period_elapsed = !runtime->no_period_wakeup;
 	}
-	spin_unlock_irqrestore(&tascam->lock, flags);
+	spin_unlock_irqrestore(&tascam->playback_lock, flags);
 
 resubmit:
+	/* Never mix into a zero-copy URB, that would write to the client's ring */
+	if (urb->transfer_buffer == tascam->playback_urb_buf[idx])
+		tascam_mix_playback(tascam, urb->transfer_buffer,
+				    urb->transfer_buffer_length / PLAYBACK_FRAME_SIZE);
+	tascam_loopback_copy(tascam, urb->transfer_buffer, urb->transfer_buffer_length / PLAYBACK_FRAME_SIZE);
 	usb_anchor_urb(urb, &tascam->playback_anchor);
-	if (usb_submit_urb(urb, GFP_ATOMIC) < 0)
+	err = usb_submit_urb(urb, GFP_ATOMIC);
+	if (err < 0) {
+		trace_tascam_urb_submit_failed(urb, err);
 		goto exit_unanchor;
+	}
+	trace_tascam_urb_submit(urb, urb->transfer_buffer_length,
+				urb->transfer_buffer_length / PLAYBACK_FRAME_SIZE);
 
-	if (need_period_elapsed && tascam->playback_substream)
+	if (need_period_elapsed)
 		snd_pcm_period_elapsed(tascam->playback_substream);
 	return;
 
 exit_unanchor:
+	tascam_playback_release_ring(tascam, urb, idx);
 	usb_unanchor_urb(urb);
 	atomic_dec(&tascam->active_urbs);
 }
 
+void playback_urb_complete(struct urb *urb)
+{
+	struct tascam_card *tascam = urb->context;
+	u64 start_ns = tascam_stats_begin();
+	int status = urb->status;
+
+	__playback_urb_complete(urb);
+	if (tascam)
+		tascam_stats_complete(tascam, TASCAM_STATS_PLAYBACK, status, start_ns);
+}
+
+/**
+ * tascam_pll_update() - feed one feedback sample into the rate estimator
+ * @pll: the estimator state
+ * @nominal_q16: nominal frames per microframe, in Q16.16 format
+ * @sample_q16: measured frames per microframe, in Q16.16 format
+ *
+ * An alpha-beta tracker: the rate is predicted from the previous estimate
+ * plus its drift, then both are corrected by the prediction error. The
+ * first valid sample seeds the estimate directly, and the following
+ * PLL_ACQUIRE_UPDATES run a wide first-order loop so the rate locks within
+ * a few milliseconds of prepare; after that the configured bandwidth and
+ * the drift term apply.
+ * Samples more than 1/16 away from nominal are treated as link garbage.
+ *
+ * Return: true if the sample was accepted.
+ */
+VISIBLE_IF_KUNIT bool tascam_pll_update(struct tascam_pll *pll, u32 nominal_q16, u32 sample_q16)
+{
+	s64 sample = (s64)sample_q16 << 16;
+	unsigned int shift = pll->shift;
+	s64 err;
+
+	if (sample_q16 < nominal_q16 - (nominal_q16 >> 4) ||
+	    sample_q16 > nominal_q16 + (nominal_q16 >> 4))
+		return false;
+
+	if (!pll->updates) {
+		pll->rate = sample;
+		pll->drift = 0;
+		pll->updates = 1;
+		return true;
+	}
+
+	pll->rate += pll->drift;
+	err = sample - pll->rate;
+
+	/* Acquire with a wide first-order loop; drift from noise would linger */
+	if (pll->updates <= PLL_ACQUIRE_UPDATES) {
+		pll->rate += err >> min_t(unsigned int, shift, PLL_ACQUIRE_SHIFT);
+		pll->updates++;
+		return true;
+	}
+
+	pll->rate += err >> shift;
+	pll->drift += err >> (2 * shift + 2);
+	return true;
+}
+EXPORT_SYMBOL_IF_KUNIT(tascam_pll_update);
+
+/**
+ * tascam_measured_rate_mhz() - current estimate of the device sample rate
+ * @tascam: the tascam_card instance
+ *
+ * Return: the sample rate the device is consuming at, in mHz, or 0 if no
+ * stream is running or the estimator has not locked.
+ */
+u32 tascam_measured_rate_mhz(struct tascam_card *tascam)
+{
+	unsigned long flags;
+	u64 rate = 0;
+
+	spin_lock_irqsave(&tascam->playback_lock, flags);
+	if ((atomic_read(&tascam->playback_active) || tascam->running_ghost_playback) &&
+	    tascam->feedback_synced && tascam->pll.rate > 0)
+		rate = (u64)tascam->pll.rate;
+	spin_unlock_irqrestore(&tascam->playback_lock, flags);
+
+	return (rate * 8000 * 1000) >> 32;
+}
+
 /**
- * feedback_urb_complete() - completion handler for feedback isochronous URBs
+ * __feedback_urb_complete() - completion handler for feedback isochronous URBs
  * @urb: the completed URB
  *
  * Updates the PLL based on the number of samples consumed by the device.
  */
-void feedback_urb_complete(struct urb *urb)
+static void __feedback_urb_complete(struct urb *urb)
 {
 	struct tascam_card *tascam = urb->context;
 	unsigned long flags;
-	int p;
+	bool accepted;
+	int first, p, err;
+
+	trace_tascam_urb_complete(urb, urb->actual_length, 0);
 
 	if (urb->status || !tascam || (!atomic_read(&tascam->playback_active) && !tascam->running_ghost_playback)) {
 		usb_unanchor_urb(urb);
@@ -326,29 +1204,55 @@ void feedback_urb_complete(struct urb *urb)
 		return;
 	}
 
-	spin_lock_irqsave(&tascam->lock, flags);
+	spin_lock_irqsave(&tascam->playback_lock, flags);
 
-	if (tascam->feedback_urb_skip_count > 0) {
-		tascam->feedback_urb_skip_count--;
-	} else {
-		for (p = 0; p < urb->number_of_packets; p++) {
-			if (urb->iso_frame_desc[p].actual_length > 0) {
-				u8 *d = urb->transfer_buffer + urb->iso_frame_desc[p].offset;
-				u32 val = (urb->iso_frame_desc[p].actual_length >= 3) ? (d[0] + d[1] + d[2]) : (d[0] * 3);
-				u32 target = (val << 16) / 24;
-				tascam->freq_q16 = (tascam->freq_q16 * PLL_FILTER_OLD_WEIGHT +
-				target * PLL_FILTER_NEW_WEIGHT) / PLL_FILTER_DIVISOR;
-				tascam->feedback_synced = true;
-			}
+	/* Silence needs no precise rate, so the idle ghost only keeps the latest sample */
+	first = 0;
+	if (tascam->ghost_idle) {
+		for (first = urb->number_of_packets - 1; first > 0; first--) {
+			if (urb->iso_frame_desc[first].actual_length > 0)
+				break;
 		}
 	}
-	spin_unlock_irqrestore(&tascam->lock, flags);
+
+	for (p = first; p < urb->number_of_packets; p++) {
+		if (urb->iso_frame_desc[p].actual_length > 0) {
+			u8 *d = urb->transfer_buffer + urb->iso_frame_desc[p].offset;
+			u32 val = (urb->iso_frame_desc[p].actual_length >= 3) ? (d[0] + d[1] + d[2]) : (d[0] * 3);
+			u32 target = (val << 16) / 24;
+
+			accepted = tascam_pll_update(&tascam->pll, tascam->playback_nominal_q16, target);
+			trace_tascam_pll_update(target, tascam->freq_q16, tascam->phase_accum,
+						tascam->pll.drift, accepted);
+			tascam_stats_feedback(tascam, target, accepted);
+			if (!accepted)
+				continue;
+			tascam->freq_q16 = (tascam->pll.rate + 0x8000) >> 16;
+			tascam->feedback_synced = tascam->pll.updates > PLL_ACQUIRE_UPDATES;
+		}
+	}
+	spin_unlock_irqrestore(&tascam->playback_lock, flags);
 
 	usb_anchor_urb(urb, &tascam->feedback_anchor);
-	if (usb_submit_urb(urb, GFP_ATOMIC) < 0) {
+	err = usb_submit_urb(urb, GFP_ATOMIC);
+	if (err < 0) {
+		trace_tascam_urb_submit_failed(urb, err);
 		usb_unanchor_urb(urb);
 		atomic_dec(&tascam->active_urbs);
+		return;
 	}
+	trace_tascam_urb_submit(urb, urb->transfer_buffer_length, 0);
+}
+
+void feedback_urb_complete(struct urb *urb)
+{
+	struct tascam_card *tascam = urb->context;
+	u64 start_ns = tascam_stats_begin();
+	int status = urb->status;
+
+	__feedback_urb_complete(urb);
+	if (tascam)
+		tascam_stats_complete(tascam, TASCAM_STATS_FEEDBACK, status, start_ns);
 }
 
 const struct snd_pcm_ops tascam_playback_ops = {
@@ -358,5 +1262,7 @@ const struct snd_pcm_ops tascam_playback_ops = {
 	.hw_params = tascam_pcm_hw_params,
 	.prepare = tascam_playback_prepare,
 	.trigger = tascam_playback_trigger,
+	.sync_stop = tascam_playback_sync_stop,
 	.pointer = tascam_playback_pointer,
+	.get_time_info = tascam_playback_get_time_info,
 };
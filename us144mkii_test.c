@@ -0,0 +1,389 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (c) 2025 Šerif Rami <ramiserifpersia@gmail.com>
+
+#include <kunit/test.h>
+#include <linux/int_sqrt.h>
+#include <linux/slab.h>
+#if IS_ENABLED(CONFIG_ARCH_HAS_KERNEL_FPU_SUPPORT)
+#include <linux/fpu.h>
+#include <asm/simd.h>
+#endif
+#ifdef CONFIG_X86
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+#endif
+#include "us144mkii_pcm.h"
+#include "us144mkii_capture_simd.h"
+
+/* Odd, so the vector decoders' single-frame tails are exercised too */
+#define TEST_DECODE_FRAMES 255
+#define TEST_BENCH_FRAMES 1024
+#define TEST_BENCH_RUNS 16
+
+/* Fill @len bytes with xorshift32 output, a fixed pattern across runs */
+static void tascam_test_fill(u8 *buf, size_t len)
+{
+	u32 x = 0x2545f491;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		buf[i] = x;
+	}
+}
+
+/*
+ * Bit @lane of each of 8 consecutive bytes, the first byte in the MSB. The
+ * device interleaves the bits of its samples across bytes this way.
+ */
+static u32 tascam_test_gather(const u8 *p, unsigned int lane)
+{
+	u32 v = 0;
+	int k;
+
+	for (k = 0; k < 8; k++)
+		v = (v << 1) | ((p[k] >> lane) & 1);
+	return v;
+}
+
+/*
+ * Reference bit-unpacker, written from the frame layout rather than for
+ * speed: each 64-byte frame holds two 32-byte halves for channels 1/3 and
+ * 2/4, with bit lane 0 carrying the first channel of the half and lane 1
+ * the second, and the high, middle and low sample bytes in its first three
+ * 8-byte words.
+ */
+static void tascam_test_unpack(const u8 *src, u32 *dst, int frames)
+{
+	const u8 *p;
+	unsigned int lane;
+	int i, ch;
+
+	for (i = 0; i < frames; i++) {
+		for (ch = 0; ch < 4; ch++) {
+			p = src + i * 64 + (ch & 1) * 32;
+			lane = ch >> 1;
+			*dst++ = (tascam_test_gather(p, lane) << 24) |
+				 (tascam_test_gather(p + 8, lane) << 16) |
+				 (tascam_test_gather(p + 16, lane) << 8);
+		}
+	}
+}
+
+/* The inverse of tascam_test_unpack() for one frame of four samples */
+static void tascam_test_pack(const u32 *samples, u8 *frame)
+{
+	unsigned int lane, byte;
+	int ch, k;
+
+	memset(frame, 0, 64);
+	for (ch = 0; ch < 4; ch++) {
+		lane = ch >> 1;
+		for (byte = 0; byte < 3; byte++) {
+			u8 v = samples[ch] >> (24 - 8 * byte);
+
+			for (k = 0; k < 8; k++)
+				frame[(ch & 1) * 32 + byte * 8 + k] |= ((v >> (7 - k)) & 1) << lane;
+		}
+	}
+}
+
+static void tascam_test_decode_known_answers(struct kunit *test)
+{
+	static const u32 samples[][4] = {
+		{ 0x00000000, 0x7fffff00, 0x80000000, 0xffffff00 },
+		{ 0x12345600, 0xedcba900, 0x00000100, 0x80000100 },
+		{ 0xaaaaaa00, 0x55555500, 0x0f0f0f00, 0xf0f0f000 },
+	};
+	/* The first frame of the xorshift32 pattern, decoded by hand */
+	static const u32 pattern[4] = { 0x4d70d700, 0x65bac000, 0xde05ae00, 0x465d0d00 };
+	u8 frame[64];
+	u32 out[4];
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(samples); i++) {
+		tascam_test_pack(samples[i], frame);
+		tascam_decode_capture_chunk(frame, out, 1);
+		KUNIT_EXPECT_MEMEQ_MSG(test, out, samples[i], sizeof(out), "frame %d", i);
+	}
+
+	tascam_test_fill(frame, sizeof(frame));
+	tascam_decode_capture_chunk(frame, out, 1);
+	KUNIT_EXPECT_MEMEQ(test, out, pattern, sizeof(out));
+}
+
+static void tascam_test_decode_reference(struct kunit *test)
+{
+	u8 *src = kunit_kmalloc(test, TEST_DECODE_FRAMES * 64, GFP_KERNEL);
+	u32 *ref = kunit_kmalloc_array(test, TEST_DECODE_FRAMES * 4, sizeof(u32), GFP_KERNEL);
+	u32 *dst = kunit_kmalloc_array(test, TEST_DECODE_FRAMES * 4, sizeof(u32), GFP_KERNEL);
+
+	KUNIT_ASSERT_NOT_NULL(test, src);
+	KUNIT_ASSERT_NOT_NULL(test, ref);
+	KUNIT_ASSERT_NOT_NULL(test, dst);
+
+	tascam_test_fill(src, TEST_DECODE_FRAMES * 64);
+	tascam_test_unpack(src, ref, TEST_DECODE_FRAMES);
+	tascam_decode_capture_chunk(src, dst, TEST_DECODE_FRAMES);
+	KUNIT_EXPECT_MEMEQ(test, dst, ref, TEST_DECODE_FRAMES * 4 * sizeof(u32));
+}
+
+#if IS_ENABLED(CONFIG_ARCH_HAS_KERNEL_FPU_SUPPORT)
+typedef void (*tascam_test_decoder_t)(const u8 *src, u32 *dst, int frames);
+
+/* Every frame count up to TEST_DECODE_FRAMES, against the scalar decoder */
+static void tascam_test_decode_vector(struct kunit *test, tascam_test_decoder_t decode)
+{
+	u8 *src = kunit_kmalloc(test, TEST_DECODE_FRAMES * 64, GFP_KERNEL);
+	u32 *ref = kunit_kmalloc_array(test, TEST_DECODE_FRAMES * 4, sizeof(u32), GFP_KERNEL);
+	u32 *dst = kunit_kmalloc_array(test, TEST_DECODE_FRAMES * 4, sizeof(u32), GFP_KERNEL);
+	int frames;
+
+	KUNIT_ASSERT_NOT_NULL(test, src);
+	KUNIT_ASSERT_NOT_NULL(test, ref);
+	KUNIT_ASSERT_NOT_NULL(test, dst);
+
+	tascam_test_fill(src, TEST_DECODE_FRAMES * 64);
+	tascam_decode_capture_chunk(src, ref, TEST_DECODE_FRAMES);
+	for (frames = 1; frames <= TEST_DECODE_FRAMES; frames++) {
+		memset(dst, 0, TEST_DECODE_FRAMES * 4 * sizeof(u32));
+		kernel_fpu_begin();
+		decode(src, dst, frames);
+		kernel_fpu_end();
+		KUNIT_EXPECT_MEMEQ_MSG(test, dst, ref, frames * 4 * sizeof(u32),
+				       "%d frames", frames);
+		/* Nothing past the requested frames is written */
+		if (frames < TEST_DECODE_FRAMES)
+			KUNIT_EXPECT_EQ_MSG(test, dst[frames * 4], 0, "%d frames", frames);
+	}
+}
+
+static void tascam_test_decode_simd(struct kunit *test)
+{
+	if (!kernel_fpu_available())
+		kunit_skip(test, "no kernel-mode FPU");
+	tascam_test_decode_vector(test, tascam_decode_capture_chunk_simd);
+}
+
+#ifdef CONFIG_X86
+static bool tascam_test_has_avx2(void)
+{
+	return kernel_fpu_available() && boot_cpu_has(X86_FEATURE_AVX2) &&
+	       cpu_has_xfeatures(XFEATURE_MASK_SSE | XFEATURE_MASK_YMM, NULL);
+}
+
+static void tascam_test_decode_avx2(struct kunit *test)
+{
+	if (!tascam_test_has_avx2())
+		kunit_skip(test, "no AVX2");
+	tascam_test_decode_vector(test, tascam_decode_capture_chunk_avx2);
+}
+#endif
+#endif
+
+/* Best of TEST_BENCH_RUNS, in ns per frame */
+static u64 tascam_test_bench(const u8 *src, u32 *dst, void (*decode)(const u8 *, u32 *, int),
+			     bool fpu)
+{
+	u64 best = U64_MAX, t0;
+	int i;
+
+	for (i = 0; i < TEST_BENCH_RUNS; i++) {
+		if (fpu)
+			kernel_fpu_begin();
+		t0 = ktime_get_ns();
+		decode(src, dst, TEST_BENCH_FRAMES);
+		t0 = ktime_get_ns() - t0;
+		if (fpu)
+			kernel_fpu_end();
+		best = min(best, t0);
+	}
+	return div_u64(best, TEST_BENCH_FRAMES);
+}
+
+static void tascam_test_decode_speed(struct kunit *test)
+{
+	u8 *src = kunit_kmalloc(test, TEST_BENCH_FRAMES * 64, GFP_KERNEL);
+	u32 *dst = kunit_kmalloc_array(test, TEST_BENCH_FRAMES * 4, sizeof(u32), GFP_KERNEL);
+
+	KUNIT_ASSERT_NOT_NULL(test, src);
+	KUNIT_ASSERT_NOT_NULL(test, dst);
+	tascam_test_fill(src, TEST_BENCH_FRAMES * 64);
+
+	kunit_info(test, "scalar decoder: %llu ns/frame\n",
+		   tascam_test_bench(src, dst, tascam_decode_capture_chunk, false));
+#if IS_ENABLED(CONFIG_ARCH_HAS_KERNEL_FPU_SUPPORT)
+	if (kernel_fpu_available())
+		kunit_info(test, "simd decoder: %llu ns/frame\n",
+			   tascam_test_bench(src, dst, tascam_decode_capture_chunk_simd, true));
+#ifdef CONFIG_X86
+	if (tascam_test_has_avx2())
+		kunit_info(test, "avx2 decoder: %llu ns/frame\n",
+			   tascam_test_bench(src, dst, tascam_decode_capture_chunk_avx2, true));
+#endif
+#endif
+}
+
+/* Synthetic feedback samples per run; statistics cover the second half */
+#define TEST_PLL_UPDATES 4000
+/* Settle bound, and the largest acceptable mean error */
+#define TEST_PLL_LOCK_MHZ 10000
+
+/**
+ * struct tascam_test_pll_run - outcome of one synthetic feedback run
+ * @bias_mhz: mean estimation error over the second half of the run, in mHz
+ * @sd_mhz: standard deviation of the error over the same span, in mHz
+ * @settle: updates until the error stayed below TEST_PLL_LOCK_MHZ
+ */
+struct tascam_test_pll_run {
+	s64 bias_mhz;
+	u32 sd_mhz;
+	int settle;
+};
+
+/*
+ * Feed the estimator a device clock running 100 ppm fast and drifting by a
+ * further 1 ppb per update, quantised like the real endpoint in 1/24 frame
+ * per microframe. With @noisy, one sample in 32 is off by one step either
+ * way, one in 32 is lost and one in 128 reads as zero.
+ */
+static void tascam_test_pll_run(unsigned int shift, unsigned int rate, bool noisy,
+				struct tascam_test_pll_run *res)
+{
+	struct tascam_pll pll = { .shift = shift };
+	u32 nominal_q16 = div_u64((u64)rate << 16, 8000);
+	u64 nominal_q32 = div_u64((u64)rate << 32, 8000);
+	u64 acc = 0, sum2 = 0;
+	u32 x = 0x2545f491;
+	s64 sum = 0, err;
+	int i, n = 0;
+
+	res->settle = 0;
+	for (i = 0; i < TEST_PLL_UPDATES; i++) {
+		u64 true_q32 = nominal_q32 + div_u64(nominal_q32 * (100000 + i), 1000000000);
+		u32 val;
+
+		acc += 24 * true_q32;
+		val = acc >> 32;
+		acc &= 0xffffffff;
+
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		if (noisy) {
+			if ((x & 63) == 0)
+				val++;
+			else if ((x & 63) == 1)
+				val--;
+			if (((x >> 6) & 31) == 0)
+				continue;
+			if (((x >> 11) & 127) == 0)
+				val = 0;
+		}
+
+		tascam_pll_update(&pll, nominal_q16, (val << 16) / 24);
+		err = ((pll.rate - (s64)true_q32) * 8000 * 1000) >> 32;
+		if (abs(err) >= TEST_PLL_LOCK_MHZ)
+			res->settle = i + 1;
+		if (i >= TEST_PLL_UPDATES / 2) {
+			sum += err;
+			sum2 += err * err;
+			n++;
+		}
+	}
+
+	res->bias_mhz = div_s64(sum, n);
+	res->sd_mhz = int_sqrt64(div64_u64(sum2, n) - res->bias_mhz * res->bias_mhz);
+}
+
+static const unsigned int tascam_test_rates[] = { 44100, 48000, 88200, 96000 };
+
+static void tascam_test_rate_desc(const unsigned int *rate, char *desc)
+{
+	snprintf(desc, KUNIT_PARAM_DESC_SIZE, "%u Hz", *rate);
+}
+
+KUNIT_ARRAY_PARAM(tascam_test_rate, tascam_test_rates, tascam_test_rate_desc);
+
+static void tascam_test_pll_rejects_garbage(struct kunit *test)
+{
+	u32 nominal_q16 = div_u64(48000ULL << 16, 8000);
+	struct tascam_pll pll = { .shift = PLL_BANDWIDTH_DEFAULT };
+
+	KUNIT_EXPECT_FALSE(test, tascam_pll_update(&pll, nominal_q16, 0));
+	KUNIT_EXPECT_FALSE(test, tascam_pll_update(&pll, nominal_q16, nominal_q16 + nominal_q16 / 8));
+	KUNIT_EXPECT_EQ(test, pll.updates, 0);
+
+	/* The first valid sample seeds the estimate */
+	KUNIT_EXPECT_TRUE(test, tascam_pll_update(&pll, nominal_q16, nominal_q16 + 100));
+	KUNIT_EXPECT_EQ(test, pll.rate, (s64)(nominal_q16 + 100) << 16);
+	KUNIT_EXPECT_EQ(test, pll.updates, 1);
+
+	KUNIT_EXPECT_FALSE(test, tascam_pll_update(&pll, nominal_q16, 0));
+	KUNIT_EXPECT_EQ(test, pll.rate, (s64)(nominal_q16 + 100) << 16);
+}
+
+/* No bandwidth may leave a bias, it would slowly drain or overfill the buffer */
+static void tascam_test_pll_unbiased(struct kunit *test)
+{
+	const unsigned int *rate = test->param_value;
+	struct tascam_test_pll_run clean, noisy;
+	unsigned int shift;
+
+	for (shift = PLL_BANDWIDTH_MIN; shift <= PLL_BANDWIDTH_MAX; shift++) {
+		tascam_test_pll_run(shift, *rate, false, &clean);
+		tascam_test_pll_run(shift, *rate, true, &noisy);
+		KUNIT_EXPECT_LT_MSG(test, abs(clean.bias_mhz), TEST_PLL_LOCK_MHZ,
+				    "clean feedback, pll_bandwidth=%u", shift);
+		KUNIT_EXPECT_LT_MSG(test, abs(noisy.bias_mhz), TEST_PLL_LOCK_MHZ,
+				    "noisy feedback, pll_bandwidth=%u", shift);
+	}
+}
+
+/*
+ * The default bandwidth settles quickly and keeps jitter near 30 ppm on
+ * quantised feedback; the bounds leave some room over the measured values.
+ */
+static void tascam_test_pll_default(struct kunit *test)
+{
+	const unsigned int *rate = test->param_value;
+	struct tascam_test_pll_run clean, noisy;
+
+	tascam_test_pll_run(PLL_BANDWIDTH_DEFAULT, *rate, false, &clean);
+	tascam_test_pll_run(PLL_BANDWIDTH_DEFAULT, *rate, true, &noisy);
+	kunit_info(test, "settles in %d updates, jitter %u/%u mHz, bias %lld/%lld mHz (clean/noisy)\n",
+		   clean.settle, clean.sd_mhz, noisy.sd_mhz, clean.bias_mhz, noisy.bias_mhz);
+
+	KUNIT_EXPECT_LE(test, clean.settle, 500);
+	KUNIT_EXPECT_LT(test, clean.sd_mhz, 2000);
+	KUNIT_EXPECT_LT(test, noisy.sd_mhz, 10000);
+}
+
+static struct kunit_case tascam_test_cases[] = {
+	KUNIT_CASE(tascam_test_decode_known_answers),
+	KUNIT_CASE(tascam_test_decode_reference),
+#if IS_ENABLED(CONFIG_ARCH_HAS_KERNEL_FPU_SUPPORT)
+	KUNIT_CASE(tascam_test_decode_simd),
+#ifdef CONFIG_X86
+	KUNIT_CASE(tascam_test_decode_avx2),
+#endif
+#endif
+	KUNIT_CASE_SLOW(tascam_test_decode_speed),
+	KUNIT_CASE(tascam_test_pll_rejects_garbage),
+	KUNIT_CASE_PARAM(tascam_test_pll_unbiased, tascam_test_rate_gen_params),
+	KUNIT_CASE_PARAM(tascam_test_pll_default, tascam_test_rate_gen_params),
+	{}
+};
+
+static struct kunit_suite tascam_test_suite = {
+	.name = "snd-usb-us144mkii",
+	.test_cases = tascam_test_cases,
+};
+
+kunit_test_suite(tascam_test_suite);
+
+MODULE_DESCRIPTION("KUnit tests for the TASCAM US-144MKII capture decoders and rate estimator");
+MODULE_LICENSE("GPL");
+MODULE_IMPORT_NS("EXPORTED_FOR_KUNIT_TESTING");
@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+// Copyright (c) 2025 Šerif Rami <ramiserifpersia@gmail.com>
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM us144mkii
+
+#if !defined(__US144MKII_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define __US144MKII_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/usb.h>
+
+DECLARE_EVENT_CLASS(tascam_urb,
+	TP_PROTO(struct urb *urb, u32 bytes, unsigned int frames),
+	TP_ARGS(urb, bytes, frames),
+	TP_STRUCT__entry(
+		__field(u8, ep)
+		__field(int, status)
+		__field(u32, bytes)
+		__field(int, packets)
+		__field(int, start_frame)
+		__field(unsigned int, frames)
+	),
+	TP_fast_assign(
+		__entry->ep = usb_pipeendpoint(urb->pipe) |
+			      (usb_pipein(urb->pipe) ? USB_DIR_IN : 0);
+		__entry->status = urb->status;
+		__entry->bytes = bytes;
+		__entry->packets = urb->number_of_packets;
+		__entry->start_frame = urb->start_frame;
+		__entry->frames = frames;
+	),
+	TP_printk("ep=0x%02x status=%d bytes=%u packets=%d start_frame=%d frames=%u",
+		  __entry->ep, __entry->status, __entry->bytes, __entry->packets,
+		  __entry->start_frame, __entry->frames)
+);
+
+DEFINE_EVENT(tascam_urb, tascam_urb_submit,
+	TP_PROTO(struct urb *urb, u32 bytes, unsigned int frames),
+	TP_ARGS(urb, bytes, frames)
+);
+
+DEFINE_EVENT(tascam_urb, tascam_urb_complete,
+	TP_PROTO(struct urb *urb, u32 bytes, unsigned int frames),
+	TP_ARGS(urb, bytes, frames)
+);
+
+TRACE_EVENT(tascam_urb_submit_failed,
+	TP_PROTO(struct urb *urb, int err),
+	TP_ARGS(urb, err),
+	TP_STRUCT__entry(
+		__field(u8, ep)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__entry->ep = usb_pipeendpoint(urb->pipe) |
+			      (usb_pipein(urb->pipe) ? USB_DIR_IN : 0);
+		__entry->err = err;
+	),
+	TP_printk("ep=0x%02x err=%d", __entry->ep, __entry->err)
+);
+
+TRACE_EVENT(tascam_pll_update,
+	TP_PROTO(u32 sample_q16, u32 freq_q16, u32 phase_accum, s64 drift, bool accepted),
+	TP_ARGS(sample_q16, freq_q16, phase_accum, drift, accepted),
+	TP_STRUCT__entry(
+		__field(u32, sample_q16)
+		__field(u32, freq_q16)
+		__field(u32, phase_accum)
+		__field(s64, drift)
+		__field(bool, accepted)
+	),
+	TP_fast_assign(
+		__entry->sample_q16 = sample_q16;
+		__entry->freq_q16 = freq_q16;
+		__entry->phase_accum = phase_accum;
+		__entry->drift = drift;
+		__entry->accepted = accepted;
+	),
+	TP_printk("sample=0x%08x freq=0x%08x phase=0x%04x drift=%lld accepted=%d",
+		  __entry->sample_q16, __entry->freq_q16, __entry->phase_accum,
+		  __entry->drift, __entry->accepted)
+);
+
+TRACE_EVENT(tascam_stream_mode,
+	TP_PROTO(bool playback, bool ghost, int stream_refs),
+	TP_ARGS(playback, ghost, stream_refs),
+	TP_STRUCT__entry(
+		__field(bool, playback)
+		__field(bool, ghost)
+		__field(int, stream_refs)
+	),
+	TP_fast_assign(
+		__entry->playback = playback;
+		__entry->ghost = ghost;
+		__entry->stream_refs = stream_refs;
+	),
+	TP_printk("playback=%d ghost=%d refs=%d",
+		  __entry->playback, __entry->ghost, __entry->stream_refs)
+);
+
+#endif /* __US144MKII_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE us144mkii_trace
+#include <trace/define_trace.h>